@@ -0,0 +1,579 @@
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "errorf.h"
+#include "hash.h"
+
+/*
+ * Cache replacement policies for trace-driven simulation. Every policy
+ * exposes "bool access(uint32_t key)" (true on hit) and is driven by the
+ * "simulate_cache" template, so the replay loop is specialized per policy.
+ * Memory is proportional to the cache size, not to the number of flows.
+ */
+
+const uint32_t CACHE_NIL = UINT32_MAX;
+
+/**
+ * @brief Open addressing map from keys to slot numbers (linear probing,
+ * backward shift deletion). Sized for a fixed maximum number of entries.
+ */
+class SlotMap {
+
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> slots;
+    uint64_t mask;
+
+    size_t home(uint32_t key) const {
+        return hash64(key) & mask;
+    }
+
+public:
+
+    SlotMap(size_t max_entries) {
+        size_t size = 16;
+        while (size < max_entries * 2) {
+            size <<= 1;
+        }
+        keys.resize(size, CACHE_NIL);
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    /**
+     * @brief Returns the slot of "key", or CACHE_NIL if missing
+     */
+    uint32_t find(uint32_t key) const {
+        for (size_t i=home(key); ; i=(i+1)&mask) {
+            if (keys[i] == key) {
+                return slots[i];
+            }
+            if (keys[i] == CACHE_NIL) {
+                return CACHE_NIL;
+            }
+        }
+    }
+
+    void insert(uint32_t key, uint32_t slot) {
+        size_t i = home(key);
+        while (keys[i] != CACHE_NIL && keys[i] != key) {
+            i = (i+1) & mask;
+        }
+        keys[i] = key;
+        slots[i] = slot;
+    }
+
+    void erase(uint32_t key) {
+        size_t i = home(key);
+        while (keys[i] != key) {
+            if (keys[i] == CACHE_NIL) {
+                return;
+            }
+            i = (i+1) & mask;
+        }
+        /* Shift back following entries that probed past "i" */
+        size_t j = i;
+        while (true) {
+            j = (j+1) & mask;
+            if (keys[j] == CACHE_NIL) {
+                break;
+            }
+            size_t h = home(keys[j]);
+            if (((j - h) & mask) >= ((j - i) & mask)) {
+                keys[i] = keys[j];
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        keys[i] = CACHE_NIL;
+    }
+};
+
+/**
+ * @brief Pool of cache entries, each linked into one of several intrusive
+ * doubly linked lists (head is the most recent end). Used by list based
+ * policies.
+ */
+class EntryLists {
+
+    struct entry {
+        uint32_t key;
+        uint32_t prev;
+        uint32_t next;
+        uint8_t list;
+        uint8_t freq;
+    };
+
+    struct list_info {
+        uint32_t head;
+        uint32_t tail;
+        size_t size;
+    };
+
+    std::vector<entry> entries;
+    std::vector<list_info> lists;
+    std::vector<uint32_t> free_slots;
+    SlotMap map;
+
+    void link(uint32_t slot, int list) {
+        entry& e = entries[slot];
+        list_info& l = lists[list];
+        e.list = list;
+        e.prev = CACHE_NIL;
+        e.next = l.head;
+        if (l.head != CACHE_NIL) {
+            entries[l.head].prev = slot;
+        } else {
+            l.tail = slot;
+        }
+        l.head = slot;
+        l.size++;
+    }
+
+    void unlink(uint32_t slot) {
+        entry& e = entries[slot];
+        list_info& l = lists[e.list];
+        if (e.prev != CACHE_NIL) {
+            entries[e.prev].next = e.next;
+        } else {
+            l.head = e.next;
+        }
+        if (e.next != CACHE_NIL) {
+            entries[e.next].prev = e.prev;
+        } else {
+            l.tail = e.prev;
+        }
+        l.size--;
+    }
+
+public:
+
+    /**
+     * @param capacity Maximum number of entries over all lists
+     * @param num_lists Number of lists
+     */
+    EntryLists(size_t capacity, int num_lists)
+    : map(capacity)
+    {
+        entries.resize(capacity);
+        lists.resize(num_lists, list_info{CACHE_NIL, CACHE_NIL, 0});
+        free_slots.reserve(capacity);
+        for (size_t i=capacity; i>0; --i) {
+            free_slots.push_back(i-1);
+        }
+    }
+
+    uint32_t find(uint32_t key) const {
+        return map.find(key);
+    }
+
+    /**
+     * @brief Adds "key" at the head of "list", returns its slot
+     */
+    uint32_t insert(uint32_t key, int list) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        entries[slot].key = key;
+        entries[slot].freq = 0;
+        link(slot, list);
+        map.insert(key, slot);
+        return slot;
+    }
+
+    /**
+     * @brief Moves "slot" to the head of "list"
+     */
+    void move(uint32_t slot, int list) {
+        unlink(slot);
+        link(slot, list);
+    }
+
+    void erase(uint32_t slot) {
+        unlink(slot);
+        map.erase(entries[slot].key);
+        free_slots.push_back(slot);
+    }
+
+    uint32_t tail(int list) const {
+        return lists[list].tail;
+    }
+
+    size_t size(int list) const {
+        return lists[list].size;
+    }
+
+    int list_of(uint32_t slot) const {
+        return entries[slot].list;
+    }
+
+    uint8_t& freq(uint32_t slot) {
+        return entries[slot].freq;
+    }
+};
+
+/**
+ * @brief Least recently used
+ */
+class LruCache {
+
+    size_t capacity;
+    EntryLists entries;
+
+public:
+
+    LruCache(size_t capacity)
+    : capacity(capacity), entries(capacity, 1)
+    {}
+
+    bool access(uint32_t key) {
+        uint32_t slot = entries.find(key);
+        if (slot != CACHE_NIL) {
+            entries.move(slot, 0);
+            return true;
+        }
+        if (entries.size(0) == capacity) {
+            entries.erase(entries.tail(0));
+        }
+        entries.insert(key, 0);
+        return false;
+    }
+};
+
+/**
+ * @brief Least frequently used (ties broken by least recently used).
+ * Frequencies are kept while the key is cached.
+ */
+class LfuCache {
+
+    struct item {
+        uint64_t freq;
+        uint64_t tick;
+        uint32_t key;
+    };
+
+    size_t capacity;
+    uint64_t clock;
+    std::vector<item> heap;
+    SlotMap map;
+
+    static bool less(const item& a, const item& b) {
+        return a.freq < b.freq || (a.freq == b.freq && a.tick < b.tick);
+    }
+
+    void place(size_t i) {
+        map.insert(heap[i].key, i);
+    }
+
+    void sift_down(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            size_t l = 2*i + 1;
+            size_t r = l + 1;
+            if (l < heap.size() && less(heap[l], heap[smallest])) {
+                smallest = l;
+            }
+            if (r < heap.size() && less(heap[r], heap[smallest])) {
+                smallest = r;
+            }
+            if (smallest == i) {
+                break;
+            }
+            std::swap(heap[i], heap[smallest]);
+            place(i);
+            i = smallest;
+        }
+        place(i);
+    }
+
+public:
+
+    LfuCache(size_t capacity)
+    : capacity(capacity), clock(0), map(capacity)
+    {
+        heap.reserve(capacity);
+    }
+
+    bool access(uint32_t key) {
+        uint32_t idx = map.find(key);
+        if (idx != CACHE_NIL) {
+            heap[idx].freq++;
+            heap[idx].tick = clock++;
+            sift_down(idx);
+            return true;
+        }
+        if (heap.size() == capacity) {
+            map.erase(heap[0].key);
+            heap[0] = item{1, clock++, key};
+            sift_down(0);
+            return false;
+        }
+        /* New items have the lowest frequency, sift up from the bottom */
+        heap.push_back(item{1, clock++, key});
+        size_t i = heap.size() - 1;
+        while (i > 0 && less(heap[i], heap[(i-1)/2])) {
+            std::swap(heap[i], heap[(i-1)/2]);
+            place(i);
+            i = (i-1)/2;
+        }
+        place(i);
+        return false;
+    }
+};
+
+/**
+ * @brief Adaptive replacement cache (Megiddo & Modha, FAST'03)
+ */
+class ArcCache {
+
+    enum { T1 = 0, T2, B1, B2 };
+
+    size_t capacity;
+    double p;
+    EntryLists entries;
+
+    void replace(bool in_b2) {
+        size_t t1 = entries.size(T1);
+        if (t1 > 0 && (t1 > p || (in_b2 && t1 == (size_t)p))) {
+            entries.move(entries.tail(T1), B1);
+        } else if (entries.size(T2) > 0) {
+            entries.move(entries.tail(T2), B2);
+        }
+    }
+
+public:
+
+    ArcCache(size_t capacity)
+    : capacity(capacity), p(0), entries(2 * capacity, 4)
+    {}
+
+    bool access(uint32_t key) {
+        uint32_t slot = entries.find(key);
+        if (slot != CACHE_NIL) {
+            int list = entries.list_of(slot);
+            if (list == T1 || list == T2) {
+                entries.move(slot, T2);
+                return true;
+            }
+            double b1 = entries.size(B1);
+            double b2 = entries.size(B2);
+            if (list == B1) {
+                p = std::min<double>(capacity, p + std::max(b2 / b1, 1.0));
+                replace(false);
+            } else {
+                p = std::max<double>(0, p - std::max(b1 / b2, 1.0));
+                replace(true);
+            }
+            entries.move(slot, T2);
+            return false;
+        }
+
+        size_t l1 = entries.size(T1) + entries.size(B1);
+        size_t total = l1 + entries.size(T2) + entries.size(B2);
+        if (l1 == capacity) {
+            if (entries.size(T1) < capacity) {
+                entries.erase(entries.tail(B1));
+                replace(false);
+            } else {
+                entries.erase(entries.tail(T1));
+            }
+        } else if (total >= capacity) {
+            if (total == 2 * capacity) {
+                entries.erase(entries.tail(B2));
+            }
+            replace(false);
+        }
+        entries.insert(key, T1);
+        return false;
+    }
+};
+
+/**
+ * @brief S3-FIFO (Yang et al., SOSP'23): a small FIFO that filters one-hit
+ * wonders, a main FIFO with lazy promotion, and a ghost FIFO of keys
+ * recently evicted from the small queue.
+ */
+class S3FifoCache {
+
+    enum { S = 0, M, G };
+
+    size_t small_capacity;
+    size_t main_capacity;
+    EntryLists entries;
+
+    void evict_main() {
+        while (true) {
+            uint32_t t = entries.tail(M);
+            if (entries.freq(t) > 0) {
+                entries.freq(t)--;
+                entries.move(t, M);
+            } else {
+                entries.erase(t);
+                return;
+            }
+        }
+    }
+
+    void evict_small() {
+        uint32_t t = entries.tail(S);
+        if (entries.freq(t) > 0) {
+            if (entries.size(M) >= main_capacity) {
+                evict_main();
+            }
+            entries.freq(t) = 0;
+            entries.move(t, M);
+            return;
+        }
+        if (entries.size(G) >= main_capacity) {
+            entries.erase(entries.tail(G));
+        }
+        entries.move(t, G);
+    }
+
+public:
+
+    S3FifoCache(size_t capacity)
+    : small_capacity(std::max<size_t>(1, capacity / 10)),
+      main_capacity(capacity - small_capacity),
+      entries(small_capacity + 2 * main_capacity + 1, 3)
+    {
+        if (capacity < 2) {
+            throw errorf("S3-FIFO requires a capacity of at least 2 (%lu)",
+                         capacity);
+        }
+    }
+
+    bool access(uint32_t key) {
+        uint32_t slot = entries.find(key);
+        bool ghost = false;
+        if (slot != CACHE_NIL) {
+            if (entries.list_of(slot) != G) {
+                if (entries.freq(slot) < 3) {
+                    entries.freq(slot)++;
+                }
+                return true;
+            }
+            /* Re-inserted below, as eviction may trim the ghost queue */
+            ghost = true;
+            entries.erase(slot);
+        }
+
+        /* Make room in the cache (small + main) */
+        while (entries.size(S) + entries.size(M) >=
+               small_capacity + main_capacity)
+        {
+            if (entries.size(S) >= small_capacity || entries.size(M) == 0) {
+                evict_small();
+            } else {
+                evict_main();
+            }
+        }
+
+        entries.insert(key, ghost ? M : S);
+        return false;
+    }
+};
+
+/**
+ * @brief Set associative exact match cache, in the spirit of the OVS EMC:
+ * a key may live in one of "ways" slots of its set; the capacity must be a
+ * multiple of "ways". On a miss an empty slot is used if available;
+ * otherwise the slot whose key has the lowest hash is replaced
+ * (pseudo-random, as in OVS).
+ */
+class EmcCache {
+
+    size_t ways;
+    size_t sets;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> hashes;
+
+public:
+
+    EmcCache(size_t capacity, size_t ways)
+    : ways(ways)
+    {
+        if (ways == 0 || capacity < ways || capacity % ways) {
+            throw errorf("EMC capacity must be a positive multiple of its "
+                         "ways (%lu, %lu)", capacity, ways);
+        }
+        sets = capacity / ways;
+        keys.resize(sets * ways, CACHE_NIL);
+        hashes.resize(sets * ways);
+    }
+
+    bool access(uint32_t key) {
+        uint64_t h = hash64(key);
+        size_t base = (h % sets) * ways;
+        uint32_t tag = h >> 32;
+        size_t victim = base;
+        for (size_t i=base; i<base+ways; ++i) {
+            if (keys[i] == key) {
+                return true;
+            }
+            if (keys[victim] != CACHE_NIL &&
+                (keys[i] == CACHE_NIL || hashes[i] < hashes[victim]))
+            {
+                victim = i;
+            }
+        }
+        keys[victim] = key;
+        hashes[victim] = tag;
+        return false;
+    }
+};
+
+/**
+ * @brief Replays "count" references through "cache", returns the hits
+ */
+template <typename C>
+uint64_t
+simulate_cache(C& cache, const uint32_t* refs, size_t count)
+{
+    uint64_t hits = 0;
+    for (size_t i=0; i<count; ++i) {
+        hits += cache.access(refs[i]);
+    }
+    return hits;
+}
+
+/**
+ * @brief Replays "count" references through a cache of policy "policy"
+ * ("lru", "lfu", "arc", "s3fifo" or "emc") and size "capacity"; returns
+ * the number of hits
+ * @param ways Associativity, for "emc" only
+ */
+static inline uint64_t
+simulate_cache_policy(const std::string& policy,
+                      size_t capacity,
+                      size_t ways,
+                      const uint32_t* refs,
+                      size_t count)
+{
+    if (capacity == 0) {
+        return 0;
+    }
+    if (policy == "lru") {
+        LruCache cache(capacity);
+        return simulate_cache(cache, refs, count);
+    } else if (policy == "lfu") {
+        LfuCache cache(capacity);
+        return simulate_cache(cache, refs, count);
+    } else if (policy == "arc") {
+        ArcCache cache(capacity);
+        return simulate_cache(cache, refs, count);
+    } else if (policy == "s3fifo") {
+        S3FifoCache cache(capacity);
+        return simulate_cache(cache, refs, count);
+    } else if (policy == "emc") {
+        EmcCache cache(capacity, ways);
+        return simulate_cache(cache, refs, count);
+    }
+    throw errorf("Unknown cache policy \"%s\"", policy.c_str());
+}
+
+#endif
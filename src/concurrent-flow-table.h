@@ -0,0 +1,243 @@
+#ifndef CONCURRENT_FLOW_TABLE_H
+#define CONCURRENT_FLOW_TABLE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <vector>
+
+#include "errorf.h"
+#include "page-allocator.h"
+
+/**
+ * @brief Flow-id table for many threads at once. The table is sized up
+ * front for "max_flows" flows and split into shards by the high bits of
+ * the key hash; every shard is an open-addressing array with linear
+ * probing (about 50% load) that never grows, so slots never move, and
+ * inserting into a full shard throws.
+ *
+ * A slot is claimed by a CAS on its id word (empty -> busy), the key is
+ * written, and the id is published with a release store; ids come from a
+ * single atomic counter. Lookups take no lock: they read the id word with
+ * acquire, and only wait for slots that are being claimed at that moment.
+ *
+ * Ids depend on the interleaving of the threads. For repeatable ids, pass
+ * the position of every packet in the input ("order", unique per packet):
+ * each flow keeps the smallest position seen, and "deterministic_ids"
+ * returns the ids a sequential "FlowTable" pass would have assigned
+ * (order of first appearance).
+ * @tparam Key A flow key type (see flow-keys.h)
+ */
+template <typename Key>
+class ConcurrentFlowTable {
+
+    static const uint32_t empty = UINT32_MAX;
+    static const uint32_t busy = UINT32_MAX - 1;
+
+    struct slot {
+        std::atomic<uint32_t> id;
+        Key key;
+        std::atomic<uint64_t> first;
+    };
+
+    PageArray<slot> slots;
+    size_t shard_bits;
+    size_t shard_mask;
+    std::atomic<uint32_t> next_id;
+
+    slot* shard_of(uint64_t hash) {
+        size_t shard = shard_bits ? hash >> (64 - shard_bits) : 0;
+        return &slots[shard * (shard_mask + 1)];
+    }
+
+    const slot* shard_of(uint64_t hash) const {
+        size_t shard = shard_bits ? hash >> (64 - shard_bits) : 0;
+        return &slots[shard * (shard_mask + 1)];
+    }
+
+    /**
+     * @brief Waits until the slot is published; returns its id
+     */
+    static uint32_t wait_published(const slot& s) {
+        uint32_t id;
+        while ((id = s.id.load(std::memory_order_acquire)) == busy) {
+#if defined(__x86_64__)
+            __builtin_ia32_pause();
+#endif
+        }
+        return id;
+    }
+
+    static void keep_first(slot& s, uint64_t order) {
+        uint64_t current = s.first.load(std::memory_order_relaxed);
+        while (order < current &&
+               !s.first.compare_exchange_weak(current, order,
+                                              std::memory_order_relaxed)) {
+        }
+    }
+
+public:
+
+    /**
+     * @param max_flows Expected number of flows, used to size the shards.
+     * It is not enforced: an insert throws when the probes of its shard
+     * are exhausted, which depends on how evenly the flows hash.
+     * @param shards Number of shards (rounded up to a power of two)
+     */
+    ConcurrentFlowTable(size_t max_flows, size_t shards = 64)
+    : shard_bits(0), next_id(0)
+    {
+        while (((size_t)1 << shard_bits) < shards) {
+            shard_bits++;
+        }
+        shards = (size_t)1 << shard_bits;
+        /* 50% load on average, with headroom for uneven shards */
+        size_t per_shard = 16;
+        while (per_shard < (max_flows * 2 + max_flows / 2) / shards + 64) {
+            per_shard <<= 1;
+        }
+        shard_mask = per_shard - 1;
+        PageArray<slot>(shards * per_shard).swap(slots);
+        for (size_t i=0; i<slots.size(); ++i) {
+            slots[i].id.store(empty, std::memory_order_relaxed);
+            slots[i].first.store(UINT64_MAX, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Returns the id of "key"; assigns the next id if "key" is new.
+     * Thread safe.
+     * @param is_new Set to whether this call inserted "key"
+     * @param order Position of the packet in the input, for
+     * "deterministic_ids"
+     */
+    uint32_t find_or_insert(const Key& key, bool& is_new,
+                            uint64_t order = 0) {
+        uint64_t hash = key.hash();
+        slot* shard = shard_of(hash);
+        size_t i = hash & shard_mask;
+        for (size_t probes=0; probes<=shard_mask; ++probes) {
+            slot& s = shard[i];
+            uint32_t id = s.id.load(std::memory_order_acquire);
+            if (id == empty) {
+                if (s.id.compare_exchange_strong(id, busy,
+                                                 std::memory_order_acquire)) {
+                    s.key = key;
+                    s.first.store(order, std::memory_order_relaxed);
+                    uint32_t new_id = next_id.fetch_add(1,
+                            std::memory_order_relaxed);
+                    s.id.store(new_id, std::memory_order_release);
+                    is_new = true;
+                    return new_id;
+                }
+                /* Lost the race: "id" holds the winner's state */
+            }
+            if (id == busy) {
+                id = wait_published(s);
+            }
+            if (s.key == key) {
+                keep_first(s, order);
+                is_new = false;
+                return id;
+            }
+            i = (i+1) & shard_mask;
+        }
+        throw errorf("Concurrent flow table shard is full (%lu slots)",
+                     shard_mask + 1);
+    }
+
+    /**
+     * @brief Looks up "key" without inserting; returns false if absent.
+     * Thread safe.
+     */
+    bool find(const Key& key, uint32_t& id) const {
+        uint64_t hash = key.hash();
+        const slot* shard = shard_of(hash);
+        size_t i = hash & shard_mask;
+        for (size_t probes=0; probes<=shard_mask; ++probes) {
+            const slot& s = shard[i];
+            uint32_t current = wait_published(s);
+            if (current == empty) {
+                return false;
+            }
+            if (s.key == key) {
+                id = current;
+                return true;
+            }
+            i = (i+1) & shard_mask;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Returns "remap" such that remap[id] is the id of the flow in
+     * order of first appearance (smallest "order"), as a sequential pass
+     * would assign. Call after all threads are done.
+     */
+    std::vector<uint32_t> deterministic_ids() const {
+        size_t count = size();
+        std::vector<uint64_t> first(count);
+        for (size_t i=0; i<slots.size(); ++i) {
+            uint32_t id = slots[i].id.load(std::memory_order_relaxed);
+            if (id < count) {
+                first[id] = slots[i].first.load(std::memory_order_relaxed);
+            }
+        }
+        std::vector<uint32_t> by_first(count);
+        std::iota(by_first.begin(), by_first.end(), 0);
+        std::sort(by_first.begin(), by_first.end(),
+                  [&](uint32_t a, uint32_t b) {
+                      return first[a] < first[b];
+                  });
+        std::vector<uint32_t> remap(count);
+        for (size_t i=0; i<count; ++i) {
+            remap[by_first[i]] = i;
+        }
+        return remap;
+    }
+
+    /**
+     * @brief Replaces every id by remap[id] (see "deterministic_ids"). Not
+     * thread safe.
+     */
+    void renumber(const std::vector<uint32_t>& remap) {
+        for (size_t i=0; i<slots.size(); ++i) {
+            uint32_t id = slots[i].id.load(std::memory_order_relaxed);
+            if (id < remap.size()) {
+                slots[i].id.store(remap[id], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Calls "func(key, id)" on every flow, in no particular order.
+     * Call after all threads are done.
+     */
+    template <typename F>
+    void for_each(F func) const {
+        for (size_t i=0; i<slots.size(); ++i) {
+            uint32_t id = slots[i].id.load(std::memory_order_relaxed);
+            if (id != empty) {
+                func(slots[i].key, id);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of flows
+     */
+    size_t size() const {
+        return next_id.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        return slots.memory();
+    }
+};
+
+#endif
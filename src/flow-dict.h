@@ -0,0 +1,270 @@
+#ifndef FLOW_DICT_H
+#define FLOW_DICT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "errorf.h"
+#include "mapped-file.h"
+#include "flow-table.h"
+#include "trace-store.h"
+
+/*
+ * Persistent flow dictionary: the keys of all flows seen so far, in id
+ * order, so that later runs continue the numbering. A fixed header is
+ * followed by a column of keys (the raw key struct of the flow key type
+ * named in the header, with zero padding) and, if FLOW_DICT_HAS_TUPLES is
+ * set, a column with the 5-tuple of each flow's first packet; if
+ * FLOW_DICT_HAS_ADDRESSES6 is set as well, a column with the IPv6
+ * addresses of each flow follows (see "TraceStore::get_addresses6").
+ * Columns are 8-byte aligned and used in place via mmap.
+ */
+const char FLOW_DICT_MAGIC[8] = {'P','C','A','F','L','O','W','D'};
+const uint32_t FLOW_DICT_VERSION = 1;
+const uint32_t FLOW_DICT_HAS_TUPLES = 1;
+const uint32_t FLOW_DICT_HAS_ADDRESSES6 = 2;
+
+struct flow_dict_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    char key[16];
+    uint32_t key_size;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+/**
+ * @brief Returns the offset of the tuples column for "count" keys
+ */
+static inline uint64_t
+flow_dict_tuples_offset(uint64_t count, uint32_t key_size)
+{
+    uint64_t offset = sizeof(flow_dict_header) + count * key_size;
+    return (offset + 7) & ~7ULL;
+}
+
+/**
+ * @brief Returns the offset of the IPv6 addresses column for "count" keys
+ */
+static inline uint64_t
+flow_dict_addresses6_offset(uint64_t count, uint32_t key_size)
+{
+    uint64_t offset = flow_dict_tuples_offset(count, key_size) +
+                      count * sizeof(std::array<uint32_t, 5>);
+    return (offset + 7) & ~7ULL;
+}
+
+/**
+ * @brief Read-only memory mapped view of a flow dictionary of "Key"
+ */
+template <typename Key>
+class FlowDictFile {
+
+    MappedFile file;
+    const flow_dict_header* hdr;
+
+public:
+
+    FlowDictFile(const char* filename)
+    : file(filename), hdr((const flow_dict_header*)file.data())
+    {
+        if (file.size() < sizeof(flow_dict_header) ||
+                memcmp(hdr->magic, FLOW_DICT_MAGIC, sizeof(FLOW_DICT_MAGIC)) ||
+                hdr->version != FLOW_DICT_VERSION) {
+            throw errorf("File \"%s\" is not a flow dictionary", filename);
+        }
+        if (strncmp(hdr->key, Key::name(), sizeof(hdr->key)) ||
+                hdr->key_size != sizeof(Key)) {
+            throw errorf("Flow dictionary \"%s\" has key %.16s, not %s",
+                         filename, hdr->key, Key::name());
+        }
+        uint64_t expected = sizeof(flow_dict_header) + hdr->count * sizeof(Key);
+        if (hdr->flags & FLOW_DICT_HAS_TUPLES) {
+            expected = flow_dict_tuples_offset(hdr->count, sizeof(Key)) +
+                       hdr->count * sizeof(std::array<uint32_t, 5>);
+        }
+        if ((hdr->flags & FLOW_DICT_HAS_TUPLES) &&
+            (hdr->flags & FLOW_DICT_HAS_ADDRESSES6)) {
+            expected = flow_dict_addresses6_offset(hdr->count, sizeof(Key)) +
+                       hdr->count * sizeof(std::array<uint8_t, 32>);
+        }
+        if (expected > file.size()) {
+            throw errorf("Flow dictionary \"%s\" is truncated", filename);
+        }
+    }
+
+    /**
+     * @brief Returns the number of flows
+     */
+    size_t size() const {
+        return hdr->count;
+    }
+
+    /**
+     * @brief Returns the keys, indexed by flow id
+     */
+    const Key* keys() const {
+        return (const Key*)(file.data() + sizeof(flow_dict_header));
+    }
+
+    /**
+     * @brief Returns the 5-tuples, indexed by flow id, or NULL if absent
+     */
+    const std::array<uint32_t, 5>* tuples() const {
+        if (!(hdr->flags & FLOW_DICT_HAS_TUPLES)) {
+            return NULL;
+        }
+        return (const std::array<uint32_t, 5>*)(file.data() +
+                flow_dict_tuples_offset(hdr->count, sizeof(Key)));
+    }
+
+    /**
+     * @brief Returns the IPv6 addresses, indexed by flow id, or NULL if
+     * absent
+     */
+    const std::array<uint8_t, 32>* addresses6() const {
+        if (!tuples() || !(hdr->flags & FLOW_DICT_HAS_ADDRESSES6)) {
+            return NULL;
+        }
+        return (const std::array<uint8_t, 32>*)(file.data() +
+                flow_dict_addresses6_offset(hdr->count, sizeof(Key)));
+    }
+};
+
+/**
+ * @brief Returns true if "filename" exists
+ */
+static inline bool
+flow_dict_exists(const char* filename)
+{
+    return access(filename, F_OK) == 0;
+}
+
+/**
+ * @brief Loads the dictionary "filename" into the empty table "table"
+ * (ids are kept)
+ * @param trace If not NULL, gets the 5-tuple and the IPv6 addresses of
+ * every loaded flow (zeros if the dictionary has none)
+ * @returns The number of flows loaded
+ */
+template <typename Key>
+size_t
+load_flow_dict(const char* filename,
+               FlowTable<Key>& table,
+               TraceStore* trace = NULL)
+{
+    if (table.size()) {
+        throw errorf("A flow dictionary must be loaded before any packet");
+    }
+    FlowDictFile<Key> dict(filename);
+    const Key* keys = dict.keys();
+    table.reserve(dict.size());
+    for (size_t i=0; i<dict.size(); ++i) {
+        bool is_new;
+        table.find_or_insert(keys[i], is_new);
+        if (!is_new) {
+            throw errorf("Flow dictionary \"%s\" has a duplicate key at %lu",
+                         filename, i);
+        }
+    }
+    if (trace) {
+        const std::array<uint32_t, 5>* tuples = dict.tuples();
+        const std::array<uint8_t, 32>* addresses = dict.addresses6();
+        for (size_t i=0; i<dict.size(); ++i) {
+            trace->add_flow(tuples ? tuples[i] : std::array<uint32_t, 5>(),
+                            addresses ? &addresses[i] : NULL);
+        }
+    }
+    return dict.size();
+}
+
+/**
+ * @brief Writes "column" to "f" through a buffer; returns false on error
+ */
+template <typename T, int ChunkBits>
+bool
+write_flow_dict_column(FILE* f, const ChunkedColumn<T, ChunkBits>& column)
+{
+    std::vector<T> buffer;
+    buffer.reserve(4096);
+    bool ok = true;
+    for (auto& value : column) {
+        buffer.push_back(value);
+        if (buffer.size() == buffer.capacity()) {
+            ok = ok && fwrite(buffer.data(), sizeof(buffer[0]),
+                              buffer.size(), f) == buffer.size();
+            buffer.clear();
+        }
+    }
+    return ok && fwrite(buffer.data(), sizeof(buffer[0]),
+                        buffer.size(), f) == buffer.size();
+}
+
+/**
+ * @brief Saves "table" to the dictionary "filename", atomically: the
+ * dictionary is written to a temporary file in the same directory, synced,
+ * and renamed over "filename"
+ * @param trace If not NULL, the 5-tuple (and the IPv6 addresses, if any)
+ * of every flow are saved as well
+ */
+template <typename Key>
+void
+save_flow_dict(const char* filename, const FlowTable<Key>& table,
+               const TraceStore* trace = NULL)
+{
+    auto* tuples = trace ? &trace->get_tuples() : NULL;
+    if (tuples && tuples->size() != table.size()) {
+        throw errorf("Flow dictionary columns differ in size (%lu, %lu)",
+                     table.size(), tuples->size());
+    }
+    auto* addresses = trace && !trace->get_addresses6().empty() ?
+                      &trace->get_addresses6() : NULL;
+
+    flow_dict_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FLOW_DICT_MAGIC, sizeof(FLOW_DICT_MAGIC));
+    hdr.version = FLOW_DICT_VERSION;
+    hdr.flags = (tuples ? FLOW_DICT_HAS_TUPLES : 0) |
+                (addresses ? FLOW_DICT_HAS_ADDRESSES6 : 0);
+    strncpy(hdr.key, Key::name(), sizeof(hdr.key));
+    hdr.key_size = sizeof(Key);
+    hdr.count = table.size();
+
+    std::vector<Key> keys(table.size());
+    table.for_each([&](const Key& key, uint32_t id) {
+        keys[id] = key;
+    });
+
+    write_file_atomic(filename, "flow dictionary", [&](FILE* f) {
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+        ok = ok && fwrite(keys.data(), sizeof(Key), keys.size(), f) ==
+                   keys.size();
+        const char zeros[8] = {0};
+        if (tuples) {
+            uint64_t padding =
+                flow_dict_tuples_offset(hdr.count, sizeof(Key)) -
+                sizeof(hdr) - hdr.count * sizeof(Key);
+            ok = ok && fwrite(zeros, 1, padding, f) == padding;
+            ok = ok && write_flow_dict_column(f, *tuples);
+        }
+        if (tuples && addresses) {
+            uint64_t padding =
+                flow_dict_addresses6_offset(hdr.count, sizeof(Key)) -
+                flow_dict_tuples_offset(hdr.count, sizeof(Key)) -
+                hdr.count * sizeof(std::array<uint32_t, 5>);
+            ok = ok && fwrite(zeros, 1, padding, f) == padding;
+            ok = ok && write_flow_dict_column(f, *addresses);
+        }
+        return ok;
+    });
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef FLOW_KEYS_H
+#define FLOW_KEYS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+
+#include "errorf.h"
+#include "hash.h"
+
+/**
+ * @brief Header fields decoded from a packet, in host byte order
+ */
+struct packet_fields {
+    uint8_t protocol;
+    uint32_t ip_src;
+    uint32_t ip_dst;
+    uint16_t port_src;
+    uint16_t port_dst;
+
+    /* IP version (4 or 6). IPv6 addresses are in "ip6_src" and "ip6_dst",
+     * in network byte order, and "ip_src" and "ip_dst" are zero. */
+    uint8_t version;
+    uint8_t ip6_src[16];
+    uint8_t ip6_dst[16];
+
+    /**
+     * @brief Returns the 5-tuple as {protocol, src, dst, sport, dport}
+     */
+    std::array<uint32_t, 5> tuple() const {
+        return {protocol, ip_src, ip_dst, port_src, port_dst};
+    }
+};
+
+/*
+ * Flow key definitions. A flow key type defines which packets belong to
+ * the same flow, and provides:
+ *   static const char* name()           - the "--flow-key" value
+ *   static Key extract(packet_fields&)  - key extraction and masking
+ *   uint64_t hash() const               - hash for the flow-id table
+ *   bool operator==(const Key&) const   - equality
+ *   static const bool dual_stack        - whether IPv6 packets are keyed
+ * Readers and flow-id tables are templates over the key type, so key
+ * handling is specialized at compile time. Readers skip IPv6 packets
+ * unless their key is dual stack.
+ */
+
+/**
+ * @brief The full 5-tuple
+ */
+struct FiveTupleKey {
+    uint32_t ip_src;
+    uint32_t ip_dst;
+    uint16_t port_src;
+    uint16_t port_dst;
+    uint8_t protocol;
+    /* Explicit, so that copies keep it zero: keys are saved raw in
+     * dictionaries and caches */
+    uint8_t padding[3];
+
+    static const bool dual_stack = false;
+
+    static const char* name() {
+        return "5-tuple";
+    }
+
+    static FiveTupleKey extract(const packet_fields& f) {
+        FiveTupleKey k;
+        memset(&k, 0, sizeof(k));
+        k.ip_src = f.ip_src;
+        k.ip_dst = f.ip_dst;
+        k.port_src = f.port_src;
+        k.port_dst = f.port_dst;
+        k.protocol = f.protocol;
+        return k;
+    }
+
+    uint64_t hash() const {
+        uint64_t a = ((uint64_t)ip_src << 32) | ip_dst;
+        uint64_t b = ((uint64_t)port_src << 24) | ((uint64_t)port_dst << 8) |
+                     protocol;
+        return hash64(a ^ hash64(b));
+    }
+
+    bool operator==(const FiveTupleKey& o) const {
+        return ip_src == o.ip_src && ip_dst == o.ip_dst &&
+               port_src == o.port_src && port_dst == o.port_dst &&
+               protocol == o.protocol;
+    }
+};
+
+/**
+ * @brief A single 32 bit address (masked)
+ * @tparam SOURCE Whether to use the source (or destination) address
+ * @tparam PREFIX Prefix length to keep
+ */
+template <bool SOURCE, int PREFIX>
+struct AddressKey {
+    uint32_t address;
+
+    static const bool dual_stack = false;
+
+    static const char* name();
+
+    static AddressKey extract(const packet_fields& f) {
+        AddressKey k;
+        uint32_t mask = PREFIX == 0 ? 0 : (~0U << (32 - PREFIX));
+        k.address = (SOURCE ? f.ip_src : f.ip_dst) & mask;
+        return k;
+    }
+
+    uint64_t hash() const {
+        return hash64(address);
+    }
+
+    bool operator==(const AddressKey& o) const {
+        return address == o.address;
+    }
+};
+
+using SrcIpKey = AddressKey<true, 32>;
+using DstIpKey = AddressKey<false, 32>;
+using DstPrefix24Key = AddressKey<false, 24>;
+
+template <> inline const char* SrcIpKey::name() { return "src-ip"; }
+template <> inline const char* DstIpKey::name() { return "dst-ip"; }
+template <> inline const char* DstPrefix24Key::name() { return "dst-24"; }
+
+/**
+ * @brief The (source, destination) address pair
+ */
+struct SrcDstKey {
+    uint32_t ip_src;
+    uint32_t ip_dst;
+
+    static const bool dual_stack = false;
+
+    static const char* name() {
+        return "src-dst";
+    }
+
+    static SrcDstKey extract(const packet_fields& f) {
+        SrcDstKey k;
+        k.ip_src = f.ip_src;
+        k.ip_dst = f.ip_dst;
+        return k;
+    }
+
+    uint64_t hash() const {
+        return hash64(((uint64_t)ip_src << 32) | ip_dst);
+    }
+
+    bool operator==(const SrcDstKey& o) const {
+        return ip_src == o.ip_src && ip_dst == o.ip_dst;
+    }
+};
+
+/**
+ * @brief The protocol and destination port (service granularity)
+ */
+struct ProtoDstPortKey {
+    uint16_t port_dst;
+    uint8_t protocol;
+    uint8_t padding;    /* See "FiveTupleKey" */
+
+    static const bool dual_stack = true;
+
+    static const char* name() {
+        return "proto-dport";
+    }
+
+    static ProtoDstPortKey extract(const packet_fields& f) {
+        ProtoDstPortKey k;
+        memset(&k, 0, sizeof(k));
+        k.port_dst = f.port_dst;
+        k.protocol = f.protocol;
+        return k;
+    }
+
+    uint64_t hash() const {
+        return hash64(((uint64_t)protocol << 16) | port_dst);
+    }
+
+    bool operator==(const ProtoDstPortKey& o) const {
+        return port_dst == o.port_dst && protocol == o.protocol;
+    }
+};
+
+/**
+ * @brief The 5-tuple of IPv4 and IPv6 packets. Addresses take 16 bytes in
+ * network byte order, IPv4 addresses IPv4-mapped (::ffff:A.B.C.D), so both
+ * families share one flow-id table. Packed to 37 bytes.
+ */
+struct __attribute__((packed)) DualStackKey {
+    uint8_t ip_src[16];
+    uint8_t ip_dst[16];
+    uint16_t port_src;
+    uint16_t port_dst;
+    uint8_t protocol;
+
+    static const bool dual_stack = true;
+
+    static const char* name() {
+        return "5-tuple-dual";
+    }
+
+    static void map_ipv4(uint32_t address, uint8_t* out) {
+        memset(out, 0, 10);
+        out[10] = 0xff;
+        out[11] = 0xff;
+        out[12] = address >> 24;
+        out[13] = address >> 16;
+        out[14] = address >> 8;
+        out[15] = address;
+    }
+
+    static DualStackKey extract(const packet_fields& f) {
+        DualStackKey k;
+        if (f.version == 6) {
+            memcpy(k.ip_src, f.ip6_src, sizeof(k.ip_src));
+            memcpy(k.ip_dst, f.ip6_dst, sizeof(k.ip_dst));
+        } else {
+            map_ipv4(f.ip_src, k.ip_src);
+            map_ipv4(f.ip_dst, k.ip_dst);
+        }
+        k.port_src = f.port_src;
+        k.port_dst = f.port_dst;
+        k.protocol = f.protocol;
+        return k;
+    }
+
+    uint64_t hash() const {
+        uint64_t words[4];
+        memcpy(words, ip_src, sizeof(ip_src));
+        memcpy(words + 2, ip_dst, sizeof(ip_dst));
+        uint64_t h = hash64(((uint64_t)port_src << 24) |
+                            ((uint64_t)port_dst << 8) | protocol);
+        for (uint64_t word : words) {
+            h = hash64(h ^ word);
+        }
+        return h;
+    }
+
+    bool operator==(const DualStackKey& o) const {
+        return memcmp(this, &o, sizeof(*this)) == 0;
+    }
+};
+
+static_assert(sizeof(DualStackKey) == 37, "DualStackKey must be packed");
+
+/**
+ * @brief Calls "func" with a default constructed key of the type named
+ * "name"; "func" is usually a generic lambda that instantiates the
+ * key-specific code path.
+ */
+template <typename F>
+void
+dispatch_flow_key(const std::string& name, F func)
+{
+    if (name == FiveTupleKey::name()) {
+        func(FiveTupleKey());
+    } else if (name == SrcIpKey::name()) {
+        func(SrcIpKey());
+    } else if (name == DstIpKey::name()) {
+        func(DstIpKey());
+    } else if (name == SrcDstKey::name()) {
+        func(SrcDstKey());
+    } else if (name == DstPrefix24Key::name()) {
+        func(DstPrefix24Key());
+    } else if (name == ProtoDstPortKey::name()) {
+        func(ProtoDstPortKey());
+    } else if (name == DualStackKey::name()) {
+        func(DualStackKey());
+    } else {
+        throw errorf("Unknown flow key \"%s\" (supported: 5-tuple, src-ip, "
+                     "dst-ip, src-dst, dst-24, proto-dport, 5-tuple-dual)",
+                     name.c_str());
+    }
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef FLOW_TABLE_H
+#define FLOW_TABLE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "page-allocator.h"
+
+/**
+ * @brief Assigns dense ids (0, 1, 2, ...) to flow keys in order of first
+ * appearance. Open addressing with linear probing; grows at 50% load. The
+ * slots are a single page block (huge pages if enabled, see
+ * page-allocator.h).
+ * @tparam Key A flow key type (see flow-keys.h)
+ */
+template <typename Key>
+class FlowTable {
+
+    static const uint32_t empty = UINT32_MAX;
+
+    struct slot {
+        Key key;
+        uint32_t id;
+    };
+
+    PageArray<slot> slots;
+    size_t mask;
+    size_t count;
+
+    void rehash(size_t size) {
+        PageArray<slot> old(size);
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (size_t i=0; i<slots.size(); ++i) {
+            slots[i].id = empty;
+        }
+        for (size_t j=0; j<old.size(); ++j) {
+            const slot& s = old[j];
+            if (s.id == empty) {
+                continue;
+            }
+            size_t i = s.key.hash() & mask;
+            while (slots[i].id != empty) {
+                i = (i+1) & mask;
+            }
+            slots[i] = s;
+        }
+    }
+
+    /**
+     * @brief "find_or_insert" with the hash of "key" already computed
+     */
+    uint32_t find_or_insert(const Key& key, uint64_t hash, bool& is_new) {
+        size_t i = hash & mask;
+        while (slots[i].id != empty) {
+            if (slots[i].key == key) {
+                is_new = false;
+                return slots[i].id;
+            }
+            i = (i+1) & mask;
+        }
+        is_new = true;
+        slots[i].key = key;
+        slots[i].id = count++;
+        if (count * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+        }
+        return count - 1;
+    }
+
+public:
+
+    /* Largest burst resolved at once by "find_or_insert_burst" */
+    static const size_t burst_size = 32;
+
+    FlowTable(size_t initial = 1024)
+    : count(0)
+    {
+        size_t size = 16;
+        while (size < initial * 2) {
+            size <<= 1;
+        }
+        PageArray<slot>(size).swap(slots);
+        mask = size - 1;
+        for (size_t i=0; i<size; ++i) {
+            slots[i].id = empty;
+        }
+    }
+
+    /**
+     * @brief Returns the id of "key"; assigns the next id if "key" is new
+     * @param is_new Set to whether "key" was inserted
+     */
+    uint32_t find_or_insert(const Key& key, bool& is_new) {
+        return find_or_insert(key, key.hash(), is_new);
+    }
+
+    /**
+     * @brief Calls "find_or_insert" on "length" keys at once. The keys are
+     * hashed and their first slots prefetched, bursts of "burst_size" at a
+     * time, before any is resolved: with a table larger than the caches,
+     * the misses of a burst overlap instead of stalling one after the
+     * other. Keys are resolved in order, so ids are the same as with one
+     * call per key.
+     * @param ids Set to the id of every key
+     * @param is_new Set to whether every key was inserted
+     */
+    void find_or_insert_burst(const Key* keys, size_t length, uint32_t* ids,
+                              bool* is_new) {
+        uint64_t hashes[burst_size];
+        for (size_t first=0; first<length; first+=burst_size) {
+            size_t n = std::min<size_t>(size_t(burst_size), length - first);
+            for (size_t k=0; k<n; ++k) {
+                hashes[k] = keys[first + k].hash();
+                __builtin_prefetch(&slots[hashes[k] & mask]);
+            }
+            for (size_t k=0; k<n; ++k) {
+                ids[first + k] = find_or_insert(keys[first + k], hashes[k],
+                                                is_new[first + k]);
+            }
+        }
+    }
+
+    /**
+     * @brief Makes room for "flows" flows without growing
+     */
+    void reserve(size_t flows) {
+        size_t size = slots.size();
+        while (size < flows * 2 + 2) {
+            size <<= 1;
+        }
+        if (size > slots.size()) {
+            rehash(size);
+        }
+    }
+
+    /**
+     * @brief Calls "func(key, id)" on every flow, in no particular order
+     */
+    template <typename F>
+    void for_each(F func) const {
+        for (size_t i=0; i<slots.size(); ++i) {
+            if (slots[i].id != empty) {
+                func(slots[i].key, slots[i].id);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of flows
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        return slots.memory();
+    }
+};
+
+#endif
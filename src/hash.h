@@ -0,0 +1,22 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Mixes a 64 bit integer into a well distributed 64 bit hash value
+ * (the splitmix64 finalizer). Used wherever flow identifiers must be
+ * spread uniformly, e.g. by sketches and samplers.
+ */
+static inline uint64_t
+hash64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <ostream>
+
+#include "errorf.h"
+
+/**
+ * @brief Log-linear (HDR style) histogram of non-negative integers.
+ * Every power of two is split into 2^sub_bucket_bits linear sub-buckets,
+ * so values are kept with a relative error below 2^-sub_bucket_bits, and
+ * values smaller than 2^(sub_bucket_bits+1) are kept exactly. Recording
+ * is O(1); histograms with the same resolution can be merged.
+ */
+class Histogram {
+
+    int sub_bucket_bits;
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t min_value;
+    uint64_t max_value;
+    double sum;
+
+public:
+
+    Histogram(int sub_bucket_bits = 7)
+    : sub_bucket_bits(sub_bucket_bits),
+      total(0),
+      min_value(UINT64_MAX),
+      max_value(0),
+      sum(0)
+    {
+        if (sub_bucket_bits < 1 || sub_bucket_bits > 16) {
+            throw errorf("Histogram sub-bucket bits must be within [1,16], "
+                         "got %d", sub_bucket_bits);
+        }
+        counts.resize(2ULL << sub_bucket_bits);
+    }
+
+    /**
+     * @brief Returns the bucket index of "value". Exposed so that users
+     * with non-integer weights can share the same bucketing.
+     */
+    size_t index_of(uint64_t value) const {
+        if (value < (2ULL << sub_bucket_bits)) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - sub_bucket_bits;
+        uint64_t mantissa = value >> shift;
+        return ((size_t)(shift + 1) << sub_bucket_bits) +
+               (mantissa - (1ULL << sub_bucket_bits));
+    }
+
+    /**
+     * @brief Returns the lowest value that maps to bucket "idx"
+     */
+    uint64_t lowest_of(size_t idx) const {
+        if (idx < (2ULL << sub_bucket_bits)) {
+            return idx;
+        }
+        int shift = (idx >> sub_bucket_bits) - 1;
+        uint64_t mantissa = (idx & ((1ULL << sub_bucket_bits) - 1)) +
+                            (1ULL << sub_bucket_bits);
+        return mantissa << shift;
+    }
+
+    /**
+     * @brief Returns the highest value that maps to bucket "idx"
+     */
+    uint64_t highest_of(size_t idx) const {
+        if (idx < (2ULL << sub_bucket_bits)) {
+            return idx;
+        }
+        int shift = (idx >> sub_bucket_bits) - 1;
+        return lowest_of(idx) + (1ULL << shift) - 1;
+    }
+
+    /**
+     * @brief Records a single value
+     */
+    void record(uint64_t value) {
+        size_t idx = index_of(value);
+        if (__builtin_expect(idx >= counts.size(), 0)) {
+            counts.resize(idx + 1);
+        }
+        counts[idx]++;
+        total++;
+        sum += value;
+        min_value = value < min_value ? value : min_value;
+        max_value = value > max_value ? value : max_value;
+    }
+
+    /**
+     * @brief Adds all values recorded by "other" to this
+     */
+    void merge(const Histogram& other) {
+        if (other.sub_bucket_bits != sub_bucket_bits) {
+            throw errorf("Cannot merge histograms with different resolutions "
+                         "(%d, %d)", sub_bucket_bits, other.sub_bucket_bits);
+        }
+        if (other.counts.size() > counts.size()) {
+            counts.resize(other.counts.size());
+        }
+        for (size_t i=0; i<other.counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        min_value = other.min_value < min_value ? other.min_value : min_value;
+        max_value = other.max_value > max_value ? other.max_value : max_value;
+    }
+
+    /**
+     * @brief Returns the number of recorded values
+     */
+    uint64_t count() const {
+        return total;
+    }
+
+    /**
+     * @brief Returns the value at quantile "q" (in [0,1]), up to the
+     * histogram resolution
+     */
+    uint64_t quantile(double q) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = q * total;
+        if (rank >= total) {
+            rank = total - 1;
+        }
+        uint64_t current = 0;
+        for (size_t i=0; i<counts.size(); ++i) {
+            current += counts[i];
+            if (current > rank) {
+                uint64_t value = highest_of(i);
+                value = value > max_value ? max_value : value;
+                return value < min_value ? min_value : value;
+            }
+        }
+        return max_value;
+    }
+
+    /**
+     * @brief Writes a summary, common quantiles, and the CDF (one line per
+     * non-empty bucket: bucket upper bound, cumulative fraction) to "os"
+     * @param name The name of this (e.g., "packet-size")
+     */
+    void write(std::ostream& os, const char* name) const {
+        static const double quantiles[] = {
+            0, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1
+        };
+        os << "# " << name << " count " << total;
+        if (total) {
+            os << " min " << min_value
+               << " max " << max_value
+               << " mean " << sum / total;
+        }
+        os << std::endl;
+        for (double q : quantiles) {
+            os << name << " quantile " << q << " " << quantile(q) << std::endl;
+        }
+        uint64_t current = 0;
+        for (size_t i=0; i<counts.size(); ++i) {
+            if (!counts[i]) {
+                continue;
+            }
+            current += counts[i];
+            uint64_t value = highest_of(i);
+            value = value > max_value ? max_value : value;
+            os << name << " cdf " << value << " "
+               << (double)current / total << std::endl;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef HYPERLOGLOG_H
+#define HYPERLOGLOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "errorf.h"
+
+/**
+ * @brief HyperLogLog distinct counter (Flajolet et al. 2007) over 64 bit
+ * hash values. Uses 2^precision one-byte registers; the standard error of
+ * the estimation is about 1.04/sqrt(2^precision).
+ */
+class HyperLogLog {
+
+    int precision;
+    std::vector<uint8_t> registers;
+
+public:
+
+    HyperLogLog(int precision)
+    : precision(precision)
+    {
+        if (precision < 4 || precision > 18) {
+            throw errorf("HyperLogLog precision must be within [4,18], "
+                         "got %d", precision);
+        }
+        registers.resize(1 << precision);
+    }
+
+    /**
+     * @brief Adds a hash value (see "hash64" in hash.h) to this
+     */
+    void add(uint64_t hash) {
+        uint32_t idx = hash >> (64 - precision);
+        /* The guard bit bounds the rank by 64-precision+1 */
+        uint64_t w = (hash << precision) | (1ULL << (precision - 1));
+        uint8_t rank = __builtin_clzll(w) + 1;
+        if (rank > registers[idx]) {
+            registers[idx] = rank;
+        }
+    }
+
+    /**
+     * @brief Merges "other" into this (register-wise maximum)
+     */
+    void merge(const HyperLogLog& other) {
+        if (other.precision != precision) {
+            throw errorf("Cannot merge HyperLogLog with different "
+                         "precisions (%d, %d)", precision, other.precision);
+        }
+        uint8_t* dst = registers.data();
+        const uint8_t* src = other.registers.data();
+        size_t size = registers.size();
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= size; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(a, b));
+        }
+#endif
+        for (; i < size; ++i) {
+            dst[i] = dst[i] > src[i] ? dst[i] : src[i];
+        }
+    }
+
+    /**
+     * @brief Resets all registers
+     */
+    void clear() {
+        memset(registers.data(), 0, registers.size());
+    }
+
+    /**
+     * @brief Returns the estimated number of distinct values added
+     */
+    double estimate() const {
+        double m = registers.size();
+        double alpha = (m == 16) ? 0.673 :
+                       (m == 32) ? 0.697 :
+                       (m == 64) ? 0.709 :
+                       0.7213 / (1 + 1.079 / m);
+        double sum = 0;
+        int zeros = 0;
+        for (auto r : registers) {
+            sum += ldexp(1.0, -r);
+            zeros += (r == 0);
+        }
+        double e = alpha * m * m / sum;
+        /* Small range correction (linear counting) */
+        if (e <= 2.5 * m && zeros != 0) {
+            e = m * log(m / zeros);
+        }
+        return e;
+    }
+
+    /**
+     * @brief Returns the memory used by the registers, in bytes
+     */
+    size_t memory() const {
+        return registers.size();
+    }
+};
+
+/**
+ * @brief Distinct counter over a sliding window, implemented as a ring of
+ * per-step HyperLogLogs that are merged on demand. The window covers the
+ * last "buckets" steps, including the current one.
+ */
+class SlidingHyperLogLog {
+
+    std::vector<HyperLogLog> ring;
+    HyperLogLog merged;
+    size_t current;
+
+public:
+
+    SlidingHyperLogLog(int precision, int buckets)
+    : merged(precision), current(0)
+    {
+        if (buckets < 1) {
+            throw errorf("Sliding HyperLogLog requires at least one bucket");
+        }
+        ring.resize(buckets, HyperLogLog(precision));
+    }
+
+    /**
+     * @brief Adds a hash value to the current step
+     */
+    void add(uint64_t hash) {
+        ring[current].add(hash);
+    }
+
+    /**
+     * @brief Returns the estimated number of distinct values in the window
+     */
+    double estimate() {
+        merged.clear();
+        for (auto& hll : ring) {
+            merged.merge(hll);
+        }
+        return merged.estimate();
+    }
+
+    /**
+     * @brief Starts a new step; the oldest step leaves the window
+     */
+    void advance() {
+        current = (current + 1) % ring.size();
+        ring[current].clear();
+    }
+
+    /**
+     * @brief Returns the memory used by all registers, in bytes
+     */
+    size_t memory() const {
+        return (ring.size() + 1) * merged.memory();
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef INTEGER_PARSER_H
+#define INTEGER_PARSER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <memory>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+#include "errorf.h"
+#include "mapped-file.h"
+#include "read-ahead.h"
+#include "thread-pool.h"
+
+/*
+ * Parsers for text files with one integer per line (locality, sizes and
+ * timestamps files). Lines are found with a vectorized newline scan, and
+ * plain unsigned lines of up to 16 digits are converted with SIMD
+ * multiply-adds; anything else (signs, spaces, '\r', longer numbers) goes
+ * through atol. Every line yields one value (an empty line yields 0), as
+ * with getline + atol.
+ */
+
+/**
+ * @brief Returns a pointer to the first '\n' in [p, end), or "end"
+ */
+static inline const char*
+find_newline(const char* p, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (p + 16 <= end) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    const char* q = (const char*)memchr(p, '\n', end - p);
+    return q ? q : end;
+}
+
+/**
+ * @brief Returns the number of lines in [p, end)
+ */
+static inline size_t
+count_lines(const char* p, const char* end)
+{
+    size_t count = 0;
+    const char* begin = p;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (p + 16 <= end) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        p += 16;
+    }
+#endif
+    for (; p < end; ++p) {
+        count += (*p == '\n');
+    }
+    /* A last line without a newline */
+    if (end > begin && end[-1] != '\n') {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Converts the line [p, p+len) to an integer
+ * @param limit End of readable memory; the SIMD path loads 16 bytes
+ */
+static inline long
+parse_line(const char* p, size_t len, const char* limit)
+{
+#ifdef __SSE4_1__
+    if (len > 0 && len <= 16 && p + 16 <= limit) {
+        /* Right-aligns the line into 16 lanes; 0x80 lanes become zero */
+        static const struct shuffle_table {
+            uint8_t masks[17][16];
+            shuffle_table() {
+                for (int len=0; len<=16; ++len) {
+                    for (int i=0; i<16; ++i) {
+                        int src = i - (16 - len);
+                        masks[len][i] = src < 0 ? 0x80 : src;
+                    }
+                }
+            }
+        } table;
+
+        __m128i raw = _mm_loadu_si128((const __m128i*)p);
+        __m128i digits = _mm_sub_epi8(raw, _mm_set1_epi8('0'));
+        __m128i shuffle = _mm_loadu_si128((const __m128i*)table.masks[len]);
+        /* All bytes of the line must be digits */
+        __m128i bad = _mm_cmpgt_epi8(_mm_min_epu8(digits, _mm_set1_epi8(10)),
+                                     _mm_set1_epi8(9));
+        int in_line = (len == 16) ? 0xffff : ((1 << len) - 1);
+        if ((_mm_movemask_epi8(bad) & in_line) == 0) {
+            digits = _mm_shuffle_epi8(digits, shuffle);
+            __m128i pairs = _mm_maddubs_epi16(
+                    digits, _mm_setr_epi8(10,1,10,1,10,1,10,1,
+                                          10,1,10,1,10,1,10,1));
+            __m128i quads = _mm_madd_epi16(
+                    pairs, _mm_setr_epi16(100,1,100,1,100,1,100,1));
+            quads = _mm_packus_epi32(quads, quads);
+            __m128i octs = _mm_madd_epi16(
+                    quads, _mm_setr_epi16(10000,1,10000,1,10000,1,10000,1));
+            uint64_t high = (uint32_t)_mm_cvtsi128_si32(octs);
+            uint64_t low = (uint32_t)_mm_extract_epi32(octs, 1);
+            return high * 100000000ULL + low;
+        }
+    }
+#endif
+    char buffer[64];
+    len = len < sizeof(buffer) - 1 ? len : sizeof(buffer) - 1;
+    memcpy(buffer, p, len);
+    buffer[len] = 0;
+    return atol(buffer);
+}
+
+/**
+ * @brief Parses every line in [p, end) into "out", returns the number of
+ * values written
+ * @param limit End of readable memory (at least "end")
+ */
+static inline size_t
+parse_integers(const char* p, const char* end, const char* limit, long* out)
+{
+    size_t n = 0;
+    while (p < end) {
+        const char* nl = find_newline(p, end);
+        out[n++] = parse_line(p, nl - p, limit);
+        p = nl + 1;
+    }
+    return n;
+}
+
+/**
+ * @brief Parses all integers in "filename" in "num_threads" chunks (0:
+ * number of cores) on the shared thread pool. The file is mapped, split
+ * into chunks at line boundaries, lines are counted per chunk to place
+ * each chunk's output, and chunks are parsed in parallel directly into the
+ * result.
+ */
+static inline std::vector<long>
+parse_integers_file(const char* filename, int num_threads = 0)
+{
+    MappedFile file(filename);
+    const char* data = file.data();
+    const char* end = data + file.size();
+
+    if (num_threads <= 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    /* Chunks smaller than 1 MB are not worth a task */
+    num_threads = std::max<size_t>(1, std::min<size_t>(num_threads,
+                                   file.size() >> 20));
+
+    std::vector<const char*> bounds(num_threads + 1, end);
+    bounds[0] = data;
+    for (int t=1; t<num_threads; ++t) {
+        const char* p = data + file.size() * t / num_threads;
+        p = std::max(p, bounds[t-1]);
+        const char* nl = find_newline(p, end);
+        bounds[t] = nl < end ? nl + 1 : end;
+    }
+
+    std::vector<size_t> offsets(num_threads + 1, 0);
+    parallel_for(0, num_threads, 1, [&](size_t t, size_t) {
+        offsets[t+1] = count_lines(bounds[t], bounds[t+1]);
+    });
+    for (int t=0; t<num_threads; ++t) {
+        offsets[t+1] += offsets[t];
+    }
+
+    std::vector<long> output(offsets[num_threads]);
+    parallel_for(0, num_threads, 1, [&](size_t t, size_t) {
+        parse_integers(bounds[t], bounds[t+1], end,
+                       output.data() + offsets[t]);
+    });
+    return output;
+}
+
+/**
+ * @brief Streams the integers of a file in batches with bounded memory:
+ * the file is mapped, and pages behind the cursor are released. With
+ * read-ahead options, the file is instead read through "ReadAhead" into a
+ * ring of buffers, bypassing the page cache.
+ */
+class IntegerReader {
+
+    static const size_t release_size = 64 << 20;
+
+    std::unique_ptr<MappedFile> file;
+    const char* cursor;
+    const char* released;
+
+    std::unique_ptr<ReadAheadStream> stream;
+
+    size_t next_batch_mapped(long* out, size_t max) {
+        const char* end = file->data() + file->size();
+        size_t n = 0;
+        while (n < max && cursor < end) {
+            const char* nl = find_newline(cursor, end);
+            out[n++] = parse_line(cursor, nl - cursor, end);
+            cursor = nl + 1;
+        }
+        if (cursor - released >= (long)release_size) {
+            file->release(released - file->data(), cursor - released);
+            released = cursor;
+        }
+        return n;
+    }
+
+    size_t next_batch_stream(long* out, size_t max) {
+        size_t n = 0;
+        while (n < max) {
+            const char* p = stream->data();
+            const char* end = p + stream->available();
+            const char* nl = find_newline(p, end);
+            if (nl == end) {
+                /* The line continues in the next block, or the file ends */
+                size_t length = end - p;
+                if (stream->fill(length + 1) > length) {
+                    continue;
+                }
+                if (length == 0) {
+                    break;
+                }
+                out[n++] = parse_line(stream->data(), length,
+                                      stream->data() + length);
+                stream->consume(length);
+                break;
+            }
+            while (n < max && nl < end) {
+                out[n++] = parse_line(p, nl - p, end);
+                p = nl + 1;
+                nl = find_newline(p, end);
+            }
+            stream->consume(p - stream->data());
+        }
+        return n;
+    }
+
+public:
+
+    IntegerReader(const char* filename)
+    : file(new MappedFile(filename)), cursor(file->data()),
+      released(file->data())
+    {}
+
+    IntegerReader(const char* filename, const read_ahead_options& options)
+    : cursor(NULL), released(NULL),
+      stream(new ReadAheadStream(filename, options))
+    {}
+
+    /**
+     * @brief Parses up to "max" values into "out", returns how many were
+     * parsed (0 at the end of the file)
+     */
+    size_t next_batch(long* out, size_t max) {
+        return stream ? next_batch_stream(out, max)
+                      : next_batch_mapped(out, max);
+    }
+
+    /**
+     * @brief Parses the next value into "value", returns false at the end
+     * of the file
+     */
+    bool next(long& value) {
+        return next_batch(&value, 1) == 1;
+    }
+
+    /**
+     * @brief Calls "func" on every remaining value
+     */
+    template <typename F>
+    void for_each(F func) {
+        long batch[4096];
+        size_t n;
+        while ((n = next_batch(batch, 4096)) > 0) {
+            for (size_t i=0; i<n; ++i) {
+                func(batch[i]);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef IPV4_DECODE_H
+#define IPV4_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "flow-keys.h"
+
+/* Bytes of an IPv4 header, without and with the largest options */
+const uint32_t IPV4_MIN_HEADER_SIZE = 20;
+const uint32_t IPV4_MAX_HEADER_SIZE = 60;
+
+/* Bytes from the IP header that the 5-tuple can depend on: the largest
+ * header, then the source and destination ports */
+const uint32_t IPV4_TUPLE_BYTES = IPV4_MAX_HEADER_SIZE + 4;
+
+/**
+ * @brief Decodes the 5-tuple of an IPv4 packet into "fields". The TCP or
+ * UDP ports are read after the header length given by the IHL field, and
+ * are left zero if not captured or for other protocols.
+ * @param bytes Points at the IP header
+ * @param caplen Number of captured bytes from "bytes"
+ * @returns False if the IP header is truncated or its IHL is invalid
+ */
+static inline bool
+decode_ipv4_fields(const u_char* bytes, uint32_t caplen, packet_fields& fields)
+{
+    if (caplen < IPV4_MIN_HEADER_SIZE) {
+        return false;
+    }
+    const struct ip* iphdr = (const struct ip*)(bytes);
+    uint32_t header_size = iphdr->ip_hl * 4;
+    if (header_size < IPV4_MIN_HEADER_SIZE) {
+        return false;
+    }
+
+    fields.version = 4;
+    fields.protocol = iphdr->ip_p;
+    fields.ip_src = ntohl(iphdr->ip_src.s_addr);
+    fields.ip_dst = ntohl(iphdr->ip_dst.s_addr);
+    fields.port_src = 0;
+    fields.port_dst = 0;
+
+    // TCP and UDP both start with the source and destination ports
+    if ((iphdr->ip_p == IPPROTO_TCP || iphdr->ip_p == IPPROTO_UDP) &&
+        caplen >= header_size + 4)
+    {
+        uint16_t ports[2];
+        memcpy(ports, bytes + header_size, sizeof(ports));
+        fields.port_src = ntohs(ports[0]);
+        fields.port_dst = ntohs(ports[1]);
+    }
+    return true;
+}
+
+/**
+ * @brief 5-tuples of a batch of IPv4 headers, one array per field. Every
+ * field takes 32 bits, so that a vector of lanes is stored at once.
+ */
+struct ipv4_tuples {
+    static const size_t capacity = 32;
+
+    uint32_t protocol[capacity];
+    uint32_t ip_src[capacity];
+    uint32_t ip_dst[capacity];
+    uint32_t port_src[capacity];
+    uint32_t port_dst[capacity];
+    /* 1 if the header was decoded, 0 if "decode_ipv4_fields" fails */
+    uint32_t valid[capacity];
+
+    /**
+     * @brief Returns the fields of packet "i"
+     */
+    packet_fields fields(size_t i) const {
+        packet_fields f;
+        f.version = 4;
+        f.protocol = protocol[i];
+        f.ip_src = ip_src[i];
+        f.ip_dst = ip_dst[i];
+        f.port_src = port_src[i];
+        f.port_dst = port_dst[i];
+        return f;
+    }
+};
+
+/**
+ * @brief Decodes "count" (at most "ipv4_tuples::capacity") IPv4 headers
+ * into "out", one at a time
+ * @param packets Points at every IP header
+ * @param caplens Captured bytes from every IP header
+ */
+static inline void
+decode_ipv4_batch_scalar(const u_char* const* packets, const uint32_t* caplens,
+                         size_t count, ipv4_tuples& out)
+{
+    for (size_t i=0; i<count; ++i) {
+        packet_fields f;
+        out.valid[i] = decode_ipv4_fields(packets[i], caplens[i], f);
+        if (!out.valid[i]) {
+            memset(&f, 0, sizeof(f));
+        }
+        out.protocol[i] = f.protocol;
+        out.ip_src[i] = f.ip_src;
+        out.ip_dst[i] = f.ip_dst;
+        out.port_src[i] = f.port_src;
+        out.port_dst[i] = f.port_dst;
+    }
+}
+
+#if defined(__x86_64__)
+
+/**
+ * @brief Gathers the 32-bit words at "offsets" + "delta" bytes from "base"
+ * of the lanes selected by "mask" (zero in the others)
+ * @param lo,hi 64-bit offsets of lanes 0-3 and 4-7
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+gather_ipv4_words(const u_char* base, __m256i lo, __m256i hi, __m256i delta,
+                  __m256i mask)
+{
+    __m128i a = _mm256_mask_i64gather_epi32(
+            _mm_setzero_si128(), (const int*)base, _mm256_add_epi64(lo, delta),
+            _mm256_castsi256_si128(mask), 1);
+    __m128i b = _mm256_mask_i64gather_epi32(
+            _mm_setzero_si128(), (const int*)base, _mm256_add_epi64(hi, delta),
+            _mm256_extracti128_si256(mask, 1), 1);
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+}
+
+/**
+ * @brief "decode_ipv4_batch_scalar" with AVX2, eight headers at a time:
+ * the words of every field are gathered from the eight headers, the ports
+ * at the offset of each header's IHL. The checks of "decode_ipv4_fields"
+ * become lane masks; lanes that fail them are not read. Caplens must be
+ * below 2^31.
+ */
+__attribute__((target("avx2")))
+static void
+decode_ipv4_batch_avx2(const u_char* const* packets, const uint32_t* caplens,
+                       size_t count, ipv4_tuples& out)
+{
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i low4 = _mm256_set1_epi32(0x0f);
+    const __m256i low8 = _mm256_set1_epi32(0xff);
+    const __m256i low16 = _mm256_set1_epi32(0xffff);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        /* Offsets of the headers from the first one of the group */
+        const u_char* base = packets[i];
+        __m256i origin = _mm256_set1_epi64x((long long)(uintptr_t)base);
+        __m256i lo = _mm256_sub_epi64(
+                _mm256_loadu_si256((const __m256i*)(packets + i)), origin);
+        __m256i hi = _mm256_sub_epi64(
+                _mm256_loadu_si256((const __m256i*)(packets + i + 4)), origin);
+        __m256i caplen = _mm256_loadu_si256((const __m256i*)(caplens + i));
+
+        /* caplen >= 20, then IHL >= 5 */
+        __m256i ok = _mm256_cmpgt_epi32(
+                caplen, _mm256_set1_epi32(IPV4_MIN_HEADER_SIZE - 1));
+        __m256i word0 = gather_ipv4_words(base, lo, hi,
+                                          _mm256_setzero_si256(), ok);
+        __m256i header_size = _mm256_slli_epi32(
+                _mm256_and_si256(word0, low4), 2);
+        ok = _mm256_and_si256(ok, _mm256_cmpgt_epi32(
+                header_size, _mm256_set1_epi32(IPV4_MIN_HEADER_SIZE - 1)));
+
+        /* Protocol is byte 9; addresses are bytes 12-19, big endian */
+        __m256i protocol = _mm256_and_si256(_mm256_srli_epi32(
+                gather_ipv4_words(base, lo, hi, _mm256_set1_epi64x(8), ok),
+                8), low8);
+        __m256i src = _mm256_shuffle_epi8(gather_ipv4_words(
+                base, lo, hi, _mm256_set1_epi64x(12), ok), bswap);
+        __m256i dst = _mm256_shuffle_epi8(gather_ipv4_words(
+                base, lo, hi, _mm256_set1_epi64x(16), ok), bswap);
+
+        /* Ports of TCP and UDP, if caplen >= IHL + 4 */
+        __m256i l4 = _mm256_or_si256(
+                _mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_TCP)),
+                _mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_UDP)));
+        __m256i ports_ok = _mm256_and_si256(_mm256_and_si256(ok, l4),
+                _mm256_cmpgt_epi32(caplen, _mm256_add_epi32(
+                        header_size, _mm256_set1_epi32(3))));
+        __m256i ports = _mm256_shuffle_epi8(gather_ipv4_words(
+                base,
+                _mm256_add_epi64(lo, _mm256_cvtepu32_epi64(
+                        _mm256_castsi256_si128(header_size))),
+                _mm256_add_epi64(hi, _mm256_cvtepu32_epi64(
+                        _mm256_extracti128_si256(header_size, 1))),
+                _mm256_setzero_si256(), ports_ok), bswap);
+
+        _mm256_storeu_si256((__m256i*)(out.protocol + i), protocol);
+        _mm256_storeu_si256((__m256i*)(out.ip_src + i), src);
+        _mm256_storeu_si256((__m256i*)(out.ip_dst + i), dst);
+        _mm256_storeu_si256((__m256i*)(out.port_src + i),
+                            _mm256_srli_epi32(ports, 16));
+        _mm256_storeu_si256((__m256i*)(out.port_dst + i),
+                            _mm256_and_si256(ports, low16));
+        _mm256_storeu_si256((__m256i*)(out.valid + i),
+                            _mm256_srli_epi32(ok, 31));
+    }
+
+    /* Remainder of the batch */
+    ipv4_tuples tail;
+    size_t rest = count - i;
+    decode_ipv4_batch_scalar(packets + i, caplens + i, rest, tail);
+    memcpy(out.protocol + i, tail.protocol, rest * sizeof(uint32_t));
+    memcpy(out.ip_src + i, tail.ip_src, rest * sizeof(uint32_t));
+    memcpy(out.ip_dst + i, tail.ip_dst, rest * sizeof(uint32_t));
+    memcpy(out.port_src + i, tail.port_src, rest * sizeof(uint32_t));
+    memcpy(out.port_dst + i, tail.port_dst, rest * sizeof(uint32_t));
+    memcpy(out.valid + i, tail.valid, rest * sizeof(uint32_t));
+}
+
+#endif
+
+typedef void (*ipv4_batch_decoder)(const u_char* const*, const uint32_t*,
+                                   size_t, ipv4_tuples&);
+
+/**
+ * @brief Returns the fastest batch decoder that this CPU supports, and its
+ * name in "name" if not NULL
+ */
+static inline ipv4_batch_decoder
+select_ipv4_batch_decoder(const char** name = NULL)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        if (name) {
+            *name = "avx2";
+        }
+        return decode_ipv4_batch_avx2;
+    }
+#endif
+    if (name) {
+        *name = "scalar";
+    }
+    return decode_ipv4_batch_scalar;
+}
+
+/**
+ * @brief Decodes "count" (at most "ipv4_tuples::capacity") IPv4 headers
+ * into "out" with the decoder selected for this CPU on first use; same
+ * results as "decode_ipv4_fields" on every header
+ */
+static inline void
+decode_ipv4_batch(const u_char* const* packets, const uint32_t* caplens,
+                  size_t count, ipv4_tuples& out)
+{
+    static const ipv4_batch_decoder decoder = select_ipv4_batch_decoder();
+    decoder(packets, caplens, count, out);
+}
+
+#endif
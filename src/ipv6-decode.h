@@ -0,0 +1,111 @@
+#ifndef IPV6_DECODE_H
+#define IPV6_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "flow-keys.h"
+
+const uint32_t IPV6_HEADER_SIZE = 40;
+
+/* Extension headers walked before giving up on the upper-layer header */
+const int IPV6_MAX_EXTENSION_HEADERS = 8;
+
+/* Next header values of IPv6 extension headers (RFC 8200, 4303, 6275,
+ * 7401, 5533) */
+const uint8_t IPV6_NEXT_HOP_BY_HOP = 0;
+const uint8_t IPV6_NEXT_ROUTING = 43;
+const uint8_t IPV6_NEXT_FRAGMENT = 44;
+const uint8_t IPV6_NEXT_AUTH = 51;
+const uint8_t IPV6_NEXT_DEST_OPTS = 60;
+const uint8_t IPV6_NEXT_MOBILITY = 135;
+const uint8_t IPV6_NEXT_HIP = 139;
+const uint8_t IPV6_NEXT_SHIM6 = 140;
+
+/**
+ * @brief Decodes the 5-tuple of an IPv6 packet into "fields". Extension
+ * headers are walked to the upper-layer header, whose protocol is kept;
+ * TCP or UDP ports are read from it. The protocol is that of the last
+ * header reached if the chain is truncated, longer than
+ * IPV6_MAX_EXTENSION_HEADERS or ends in ESP, and ports are left zero;
+ * fragments other than the first get the protocol of the fragmented
+ * packet, without ports.
+ * @param bytes Points at the IPv6 header
+ * @param caplen Number of captured bytes from "bytes"
+ * @returns False if the IPv6 header is truncated
+ */
+static inline bool
+decode_ipv6_fields(const u_char* bytes, uint32_t caplen, packet_fields& fields)
+{
+    if (caplen < IPV6_HEADER_SIZE || (bytes[0] >> 4) != 6) {
+        return false;
+    }
+
+    fields.version = 6;
+    fields.ip_src = 0;
+    fields.ip_dst = 0;
+    memcpy(fields.ip6_src, bytes + 8, sizeof(fields.ip6_src));
+    memcpy(fields.ip6_dst, bytes + 24, sizeof(fields.ip6_dst));
+    fields.port_src = 0;
+    fields.port_dst = 0;
+
+    uint8_t next = bytes[6];
+    uint32_t offset = IPV6_HEADER_SIZE;
+    for (int i=0; i<IPV6_MAX_EXTENSION_HEADERS; ++i) {
+        uint32_t length;
+        switch (next) {
+        case IPV6_NEXT_HOP_BY_HOP:
+        case IPV6_NEXT_ROUTING:
+        case IPV6_NEXT_DEST_OPTS:
+        case IPV6_NEXT_MOBILITY:
+        case IPV6_NEXT_HIP:
+        case IPV6_NEXT_SHIM6:
+            if (caplen < offset + 2) {
+                fields.protocol = next;
+                return true;
+            }
+            length = (bytes[offset + 1] + 1) * 8;
+            break;
+        case IPV6_NEXT_AUTH:
+            if (caplen < offset + 2) {
+                fields.protocol = next;
+                return true;
+            }
+            length = (bytes[offset + 1] + 2) * 4;
+            break;
+        case IPV6_NEXT_FRAGMENT:
+            if (caplen < offset + 8) {
+                fields.protocol = next;
+                return true;
+            }
+            /* Only the first fragment carries the upper-layer header */
+            if (((bytes[offset + 2] << 8) | bytes[offset + 3]) & 0xfff8) {
+                fields.protocol = bytes[offset];
+                return true;
+            }
+            length = 8;
+            break;
+        default:
+            // TCP and UDP both start with the source and destination ports
+            fields.protocol = next;
+            if ((next == IPPROTO_TCP || next == IPPROTO_UDP) &&
+                caplen >= offset + 4)
+            {
+                uint16_t ports[2];
+                memcpy(ports, bytes + offset, sizeof(ports));
+                fields.port_src = ntohs(ports[0]);
+                fields.port_dst = ntohs(ports[1]);
+            }
+            return true;
+        }
+        next = bytes[offset];
+        offset += length;
+    }
+    fields.protocol = next;
+    return true;
+}
+
+#endif
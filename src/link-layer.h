@@ -0,0 +1,225 @@
+#ifndef LINK_LAYER_H
+#define LINK_LAYER_H
+
+#include <stdint.h>
+#include <pcap/pcap.h>
+
+/* Link-layer types as stored in pcap files */
+const int LINKTYPE_NULL = 0;
+const int LINKTYPE_ETHERNET = 1;
+const int LINKTYPE_RAW = 101;
+const int LINKTYPE_LOOP = 108;
+const int LINKTYPE_LINUX_SLL = 113;
+const int LINKTYPE_IPV4 = 228;
+const int LINKTYPE_LINUX_SLL2 = 276;
+
+const int ETHER_HEADER_SIZE = 14;
+const uint16_t ETHERTYPE_IPV4 = 0x0800;
+const uint16_t ETHERTYPE_IP6 = 0x86dd;
+const uint16_t ETHERTYPE_DOT1Q = 0x8100;
+const uint16_t ETHERTYPE_QINQ = 0x88a8;
+const uint16_t ETHERTYPE_QINQ_LEGACY = 0x9100;
+const uint16_t ETHERTYPE_MPLS = 0x8847;
+const uint16_t ETHERTYPE_MPLS_MULTICAST = 0x8848;
+
+/* Address families in LINKTYPE_NULL and LINKTYPE_LOOP headers; IPv6 has
+ * the value of the capturing OS (Linux, NetBSD/OpenBSD, FreeBSD, Darwin) */
+const uint32_t LINK_FAMILY_INET = 2;
+const uint32_t LINK_FAMILY_INET6[] = {10, 24, 28, 30};
+
+/**
+ * @brief How the network layer of a link type is found: after a header of
+ * "header_size" bytes, the network protocol is given by an ethertype at
+ * "type_offset", by a 4-byte address family at "type_offset", or by the
+ * IP version (raw captures)
+ */
+struct link_layer {
+    enum type_field {
+        ETHERTYPE,
+        FAMILY,
+        IP_VERSION
+    };
+
+    uint32_t header_size;
+    type_field field;
+    uint32_t type_offset;
+};
+
+/**
+ * @brief Returns the description of link-layer "linktype" (either a pcap
+ * file LINKTYPE_* value, or a libpcap DLT_* value), or NULL if unsupported
+ */
+static inline const link_layer*
+find_link_layer(int linktype)
+{
+    static const link_layer layers[] = {
+        {ETHER_HEADER_SIZE, link_layer::ETHERTYPE, 12},
+        {16, link_layer::ETHERTYPE, 14},
+        {20, link_layer::ETHERTYPE, 0},
+        {4, link_layer::FAMILY, 0},
+        {4, link_layer::FAMILY, 0},
+        {0, link_layer::IP_VERSION, 0},
+    };
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        return &layers[0];
+    case LINKTYPE_LINUX_SLL:
+        return &layers[1];
+    case LINKTYPE_LINUX_SLL2:
+        return &layers[2];
+    case LINKTYPE_NULL:
+        return &layers[3];
+    case LINKTYPE_LOOP:
+        return &layers[4];
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case DLT_RAW:
+        return &layers[5];
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Returns true if "ip_offset" can decode link-layer "linktype"
+ * (either a pcap file LINKTYPE_* value, or a libpcap DLT_* value)
+ */
+static inline bool
+link_layer_supported(int linktype)
+{
+    return find_link_layer(linktype) != NULL;
+}
+
+/**
+ * @brief Returns the ethertype of the network layer at "offset", guessed
+ * from the IP version, or 0
+ */
+static inline uint16_t
+ethertype_of_ip_version(const u_char* bytes, uint32_t caplen, uint32_t offset)
+{
+    if (caplen < offset + 1) {
+        return 0;
+    }
+    switch (bytes[offset] >> 4) {
+    case 4:
+        return ETHERTYPE_IPV4;
+    case 6:
+        return ETHERTYPE_IP6;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Returns the offset of the network header in a captured frame, or
+ * -1 if the frame is truncated, and sets "ethertype" to its protocol (0
+ * if unknown). VLAN and QinQ tags and MPLS label stacks are skipped; the
+ * payload of MPLS is identified by its IP version. Unsupported link layers
+ * are assumed to start with the IP header.
+ */
+static inline int
+network_offset(int linktype, const u_char* bytes, uint32_t caplen,
+               uint16_t& ethertype)
+{
+    const link_layer* link = find_link_layer(linktype);
+    if (!link || link->field == link_layer::IP_VERSION) {
+        uint32_t offset = link ? link->header_size : 0;
+        ethertype = ethertype_of_ip_version(bytes, caplen, offset);
+        return offset;
+    }
+
+    uint32_t offset = link->header_size;
+    if (caplen < offset) {
+        return -1;
+    }
+    const u_char* type = bytes + link->type_offset;
+    if (link->field == link_layer::FAMILY) {
+        /* In host byte order of the capturing machine for LINKTYPE_NULL */
+        uint32_t family = type[0] | (type[1] << 8) | (type[2] << 16) |
+                          ((uint32_t)type[3] << 24);
+        if (family > 0xffff) {
+            family = __builtin_bswap32(family);
+        }
+        ethertype = family == LINK_FAMILY_INET ? ETHERTYPE_IPV4 : 0;
+        for (uint32_t inet6 : LINK_FAMILY_INET6) {
+            if (family == inet6) {
+                ethertype = ETHERTYPE_IP6;
+            }
+        }
+        return offset;
+    }
+
+    ethertype = (type[0] << 8) | type[1];
+    for (;;) {
+        switch (ethertype) {
+        case ETHERTYPE_DOT1Q:
+        case ETHERTYPE_QINQ:
+        case ETHERTYPE_QINQ_LEGACY:
+            /* Tag: TCI, then the next ethertype */
+            if (caplen < offset + 4) {
+                return -1;
+            }
+            ethertype = (bytes[offset + 2] << 8) | bytes[offset + 3];
+            offset += 4;
+            break;
+        case ETHERTYPE_MPLS:
+        case ETHERTYPE_MPLS_MULTICAST:
+            /* Labels up to the bottom of the stack */
+            do {
+                if (caplen < offset + 4) {
+                    return -1;
+                }
+                offset += 4;
+            } while (!(bytes[offset - 2] & 1));
+            ethertype = ethertype_of_ip_version(bytes, caplen, offset);
+            return offset;
+        default:
+            return offset;
+        }
+    }
+}
+
+/**
+ * @brief Returns the offset of the IP header in a captured frame, or -1
+ * if the frame carries neither IPv4 nor IPv6 (see "network_offset"), and
+ * sets "version" to 4 or 6
+ */
+static inline int
+ip_offset(int linktype, const u_char* bytes, uint32_t caplen, int& version)
+{
+    uint16_t ethertype;
+    int offset = network_offset(linktype, bytes, caplen, ethertype);
+    if (offset < 0 || caplen < (uint32_t)offset + 1) {
+        return -1;
+    }
+    version = bytes[offset] >> 4;
+    if ((ethertype == ETHERTYPE_IPV4 && version == 4) ||
+        (ethertype == ETHERTYPE_IP6 && version == 6))
+    {
+        return offset;
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the offset of the IPv4 header in a captured frame, or -1
+ * if the frame does not carry IPv4 (see "network_offset")
+ */
+static inline int
+ipv4_offset(int linktype, const u_char* bytes, uint32_t caplen)
+{
+    int version;
+    int offset = ip_offset(linktype, bytes, caplen, version);
+    return offset >= 0 && version == 4 ? offset : -1;
+}
+
+/**
+ * @brief Returns the libpcap DLT_* value of a pcap file LINKTYPE_* value
+ */
+static inline int
+linktype_to_dlt(int linktype)
+{
+    return linktype == LINKTYPE_RAW ? DLT_RAW : linktype;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef LOCALITY_STREAM_H
+#define LOCALITY_STREAM_H
+
+#include <stdint.h>
+
+#include <string>
+#include <memory>
+
+#include "flow-keys.h"
+#include "flow-table.h"
+#include "trace-store.h"
+#include "flow-dict.h"
+
+/**
+ * @brief A locality stream (flow id per packet) of one flow key. Used to
+ * extract several key granularities from a single pass over the packets;
+ * see "PcapReader::add_locality_stream".
+ */
+class LocalityStream {
+
+protected:
+
+    ChunkedColumn<uint32_t> locality;
+
+public:
+
+    virtual ~LocalityStream() {}
+
+    /**
+     * @brief Returns the flow key name of this
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Returns true if the flow key of this keys IPv6 packets
+     */
+    virtual bool dual_stack() const = 0;
+
+    /**
+     * @brief Assigns a flow id to the packet with "fields" and appends it
+     */
+    virtual void push(const packet_fields& fields) = 0;
+
+    /**
+     * @brief Returns the number of distinct flows
+     */
+    virtual size_t flows() const = 0;
+
+    /**
+     * @brief Continues the flow ids of the dictionary "filename" (see
+     * flow-dict.h); returns the number of flows loaded
+     */
+    virtual size_t load_flow_dict(const char* filename) = 0;
+
+    /**
+     * @brief Saves the flow ids to the dictionary "filename"
+     */
+    virtual void save_flow_dict(const char* filename) const = 0;
+
+    const ChunkedColumn<uint32_t>& get_locality() const {
+        return locality;
+    }
+};
+
+/**
+ * @brief Locality stream of flow key "Key"
+ */
+template <typename Key>
+class KeyedLocalityStream : public LocalityStream {
+
+    FlowTable<Key> table;
+
+public:
+
+    const char* name() const {
+        return Key::name();
+    }
+
+    bool dual_stack() const {
+        return Key::dual_stack;
+    }
+
+    void push(const packet_fields& fields) {
+        bool is_new;
+        locality.push_back(table.find_or_insert(Key::extract(fields), is_new));
+    }
+
+    size_t flows() const {
+        return table.size();
+    }
+
+    size_t load_flow_dict(const char* filename) {
+        return ::load_flow_dict(filename, table);
+    }
+
+    void save_flow_dict(const char* filename) const {
+        ::save_flow_dict(filename, table);
+    }
+};
+
+/**
+ * @brief Creates a locality stream for the flow key named "name"
+ */
+static inline std::unique_ptr<LocalityStream>
+make_locality_stream(const std::string& name)
+{
+    std::unique_ptr<LocalityStream> stream;
+    dispatch_flow_key(name, [&](auto key) {
+        stream.reset(new KeyedLocalityStream<decltype(key)>());
+    });
+    return stream;
+}
+
+#endif
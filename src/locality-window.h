@@ -0,0 +1,356 @@
+#ifndef LOCALITY_WINDOW_H
+#define LOCALITY_WINDOW_H
+
+#include <deque>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "errorf.h"
+#include "hash.h"
+#include "hyperloglog.h"
+#include "page-allocator.h"
+#include "thread-pool.h"
+
+/**
+ * @brief Result of a step of "LocalityWindow"
+ */
+struct locality_row {
+    /* The locality reuse factor (0-1) */
+    double reuse;
+    /* The estimated number of distinct flows in the window, or -1 */
+    long distinct;
+};
+
+/**
+ * @brief Receives the rows of "LocalityWindow", one per step, in order
+ */
+typedef std::function<void(const locality_row&)> locality_sink;
+
+/**
+ * @brief Writes "row" as a line: the reuse factor (float precision),
+ * followed by the distinct flows if estimated
+ */
+static inline void
+write_locality_row(std::ostream& os, const locality_row& row)
+{
+    os << (float)row.reuse;
+    if (row.distinct >= 0) {
+        os << " " << row.distinct;
+    }
+    os << std::endl;
+}
+
+/**
+ * @brief Slides a window over a stream of (flow, timestamp) records and
+ * produces a row per step: the locality reuse factor, optionally with the
+ * estimated number of distinct flows in the window (see "locality_row").
+ *
+ * The window is either the last "window" records (count mode), or the
+ * records of the last "window" usec (time mode). Records enter and leave
+ * the window incrementally (two pointers), so each record costs O(1).
+ *
+ * In count mode the reuse factor is the number of records in the step
+ * whose flow was already in the window, divided by the window size. In
+ * time mode it is divided by the number of records in the step. Steps in
+ * time mode start at the timestamp of the first record; a step without
+ * records reports 0.
+ */
+class LocalityWindow {
+
+    bool by_time;
+    long window;
+    long step;
+    SlidingHyperLogLog* distinct;
+    locality_sink sink;
+
+    std::deque<std::pair<long, long>> records;
+    /* Window counts per flow; nodes come from an arena */
+    Arena arena;
+    std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+                       ArenaAllocator<std::pair<const long, long>>> counts;
+    long reuse;
+    long step_records;
+    long next_boundary;
+    bool started;
+    bool muted;
+
+    void emit() {
+        if (muted) {
+            if (distinct) {
+                distinct->advance();
+            }
+            reuse = 0;
+            step_records = 0;
+            return;
+        }
+        long denominator = by_time ? step_records : window;
+        locality_row row;
+        row.reuse = denominator ? (double)reuse / denominator : 0;
+        row.distinct = -1;
+        if (distinct) {
+            row.distinct = (long)distinct->estimate();
+            distinct->advance();
+        }
+        sink(row);
+        reuse = 0;
+        step_records = 0;
+    }
+
+    void evict() {
+        auto it = counts.find(records.front().first);
+        if (--it->second == 0) {
+            counts.erase(it);
+        }
+        records.pop_front();
+    }
+
+public:
+
+    /**
+     * @param by_time Whether "window" and "step" are in usec (or records)
+     * @param distinct If not NULL, also estimate the number of distinct
+     * flows within the window
+     * @param sink Receives the row of every step
+     */
+    LocalityWindow(bool by_time,
+                   long window,
+                   long step,
+                   SlidingHyperLogLog* distinct,
+                   locality_sink sink)
+    : by_time(by_time),
+      window(window),
+      step(step),
+      distinct(distinct),
+      sink(std::move(sink)),
+      counts(16, std::hash<long>(), std::equal_to<long>(),
+             ArenaAllocator<std::pair<const long, long>>(&arena)),
+      reuse(0),
+      step_records(0),
+      next_boundary(0),
+      started(false),
+      muted(false)
+    {
+        if (window <= 0 || step <= 0) {
+            throw errorf("Window (%ld) and step (%ld) must be positive",
+                         window, step);
+        }
+    }
+
+    /**
+     * @brief Same, but writes the rows as lines into "os" (see
+     * "write_locality_row")
+     */
+    LocalityWindow(bool by_time,
+                   long window,
+                   long step,
+                   SlidingHyperLogLog* distinct,
+                   std::ostream& os)
+    : LocalityWindow(by_time, window, step, distinct,
+                     [&os](const locality_row& row) {
+                         write_locality_row(os, row);
+                     })
+    {}
+
+    /**
+     * @brief Returns true if records must carry timestamps
+     */
+    bool needs_times() const {
+        return by_time;
+    }
+
+    /**
+     * @brief While muted, steps are processed but not written. Used to warm
+     * up the window state from the records that precede a segment.
+     */
+    void mute(bool value) {
+        muted = value;
+    }
+
+    /**
+     * @brief In time mode, sets the end of the first step (instead of the
+     * timestamp of the first record plus "step")
+     */
+    void start_at(long boundary) {
+        next_boundary = boundary;
+        started = true;
+    }
+
+    /**
+     * @brief In time mode, completes every step that ends at or before
+     * "time"
+     */
+    void advance_to(long time) {
+        while (started && time >= next_boundary) {
+            emit();
+            next_boundary += step;
+        }
+    }
+
+    /**
+     * @brief Pushes the next record into the window
+     * @param flow The flow id
+     * @param time The timestamp (usec), used in time mode only
+     */
+    void push(long flow, long time) {
+        if (by_time) {
+            if (!started) {
+                next_boundary = time + step;
+                started = true;
+            }
+            advance_to(time);
+            while (!records.empty() &&
+                   records.front().second <= time - window) {
+                evict();
+            }
+        }
+
+        if (counts.find(flow) != counts.end()) {
+            reuse++;
+        }
+        if (distinct) {
+            distinct->add(hash64(flow));
+        }
+        records.emplace_back(flow, time);
+        counts[flow]++;
+        step_records++;
+
+        if (!by_time) {
+            if ((long)records.size() > window) {
+                evict();
+            }
+            if (step_records == step) {
+                emit();
+            }
+        }
+    }
+};
+
+/**
+ * @brief Runs "LocalityWindow" over in-memory columns in "num_threads"
+ * segments on the shared thread pool, and gives "sink" the same rows as a
+ * sequential run. The steps are split into contiguous segments; each
+ * segment warms up a private window from the ceil(window/step) steps that
+ * precede it (enough for both the window and the distinct-flows ring),
+ * then keeps the rows of its steps. Rows are passed to "sink" in order, on
+ * the calling thread, as soon as the segments before them are done.
+ * @param flows Flow id per record
+ * @param times Timestamp per record (usec); required in time mode. Time
+ * mode falls back to a single segment if timestamps are not sorted.
+ * @param hll_precision If positive, also estimate the distinct flows
+ */
+template <typename F, typename T>
+void
+analyze_locality_parallel(const F* flows,
+                          const T* times,
+                          size_t count,
+                          bool by_time,
+                          long window,
+                          long step,
+                          int hll_precision,
+                          int num_threads,
+                          const locality_sink& sink)
+{
+    if (count == 0) {
+        return;
+    }
+    if (by_time && !times) {
+        throw errorf("Time windows require timestamps");
+    }
+
+    long buckets = (window + step - 1) / step;
+    long steps;
+    if (by_time) {
+        steps = (times[count-1] - times[0]) / step;
+        if (!std::is_sorted(times, times + count)) {
+            num_threads = 1;
+        }
+    } else {
+        steps = count / step;
+    }
+    num_threads = std::max(1L, std::min<long>(num_threads, steps));
+
+    /* Returns the index of the first record of step "k" */
+    auto first_record = [&](long k) -> size_t {
+        if (!by_time) {
+            return k * step;
+        }
+        if (k == 0) {
+            return 0;
+        }
+        return std::lower_bound(times, times + count,
+                                (T)(times[0] + k * step)) - times;
+    };
+
+    ordered_for<std::vector<locality_row>>(num_threads, [&](size_t t) {
+        long first = steps * t / num_threads;
+        long last = steps * (t+1) / num_threads;
+        long warm = std::max(0L, first - buckets);
+
+        std::unique_ptr<SlidingHyperLogLog> distinct;
+        if (hll_precision > 0) {
+            distinct.reset(new SlidingHyperLogLog(hll_precision, buckets));
+        }
+        std::vector<locality_row> rows;
+        LocalityWindow sliding(by_time, window, step, distinct.get(),
+                               [&rows](const locality_row& row) {
+                                   rows.push_back(row);
+                               });
+
+        size_t begin = first_record(warm);
+        size_t middle = first_record(first);
+        size_t end = ((int)t == num_threads - 1) ? count : first_record(last);
+
+        if (by_time) {
+            sliding.start_at(times[0] + (warm + 1) * step);
+        }
+        sliding.mute(true);
+        for (size_t i=begin; i<middle; ++i) {
+            sliding.push(flows[i], times ? times[i] : 0);
+        }
+        if (by_time) {
+            sliding.advance_to(times[0] + first * step);
+        }
+        sliding.mute(false);
+        for (size_t i=middle; i<end; ++i) {
+            sliding.push(flows[i], times ? times[i] : 0);
+        }
+        if (by_time) {
+            sliding.advance_to(times[0] + last * step);
+        }
+        return rows;
+    }, [&](size_t t, const std::vector<locality_row>& rows) {
+        for (auto& row : rows) {
+            sink(row);
+        }
+    });
+}
+
+/**
+ * @brief Same, but writes the rows as lines into "os" (see
+ * "write_locality_row")
+ */
+template <typename F, typename T>
+void
+analyze_locality_parallel(const F* flows,
+                          const T* times,
+                          size_t count,
+                          bool by_time,
+                          long window,
+                          long step,
+                          int hll_precision,
+                          int num_threads,
+                          std::ostream& os)
+{
+    analyze_locality_parallel(flows, times, count, by_time, window, step,
+                              hll_precision, num_threads,
+                              [&os](const locality_row& row) {
+                                  write_locality_row(os, row);
+                              });
+}
+
+#endif
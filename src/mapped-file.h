@@ -0,0 +1,113 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "errorf.h"
+
+/**
+ * @brief Read-only memory mapping of a whole file
+ */
+class MappedFile {
+
+    void* base;
+    size_t length;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+
+    /**
+     * @param filename The file to map
+     * @param advice madvise(2) advice for the whole mapping
+     */
+    MappedFile(const char* filename, int advice = MADV_SEQUENTIAL)
+    : base(NULL), length(0)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            throw errorf("Cannot read file \"%s\"", filename);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw errorf("Cannot stat file \"%s\"", filename);
+        }
+        length = st.st_size;
+        /* Empty files cannot be mapped; they are represented by NULL */
+        if (length) {
+            base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                close(fd);
+                throw errorf("Cannot mmap file \"%s\"", filename);
+            }
+            madvise(base, length, advice);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (base) {
+            munmap(base, length);
+        }
+    }
+
+    const char* data() const {
+        return (const char*)base;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * @brief Tells the kernel that the pages in [offset, offset+len) will
+     * not be read again, so they can be dropped from this process
+     */
+    void release(size_t offset, size_t len) const {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = (offset + page - 1) / page * page;
+        size_t end = (offset + len) / page * page;
+        if (base && end > start) {
+            madvise((char*)base + start, end - start, MADV_DONTNEED);
+        }
+    }
+};
+
+/**
+ * @brief Writes the file "filename" atomically, for files later mapped
+ * with "MappedFile": "write" fills a temporary file in the same directory,
+ * which is synced and renamed over "filename". On error the temporary
+ * file is removed, any previous "filename" is left in place, and an error
+ * naming "what" (e.g. "index") is thrown.
+ * @param write Called with the temporary file, returns false on error
+ */
+template <typename Writer>
+void
+write_file_atomic(const std::string& filename, const char* what,
+                  const Writer& write)
+{
+    std::string tmp = filename + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        throw errorf("Cannot write to file \"%s\"", tmp.c_str());
+    }
+    bool ok = write(f);
+    ok = fflush(f) == 0 && ok;
+    ok = ok && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw errorf("Error while writing %s \"%s\"", what,
+                     filename.c_str());
+    }
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef MISS_RATIO_CURVE_H
+#define MISS_RATIO_CURVE_H
+
+#include <stdint.h>
+#include <math.h>
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <ostream>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+#include "errorf.h"
+#include "hash.h"
+#include "histogram.h"
+
+/**
+ * @brief Builds the LRU miss-ratio curve of a reference stream in one pass
+ * from its stack (reuse) distances. Supports SHARDS spatial sampling
+ * (Waldspurger et al., FAST'15): a reference is processed only if the hash
+ * of its value is below a threshold, and its distance is scaled by the
+ * inverse sampling rate; the difference between the expected and actual
+ * number of sampled references is credited to the smallest distance
+ * (SHARDS-adj). With "max_tracked" set, the threshold is lowered
+ * whenever more values are tracked, so memory stays constant.
+ */
+class MissRatioCurve {
+
+    /* Hash values are compared modulo this */
+    static const uint64_t modulus = 1ULL << 24;
+
+    /* Order statistics over the last access time of each tracked value */
+    using time_tree = __gnu_pbds::tree<uint64_t,
+                                       __gnu_pbds::null_type,
+                                       std::less<uint64_t>,
+                                       __gnu_pbds::rb_tree_tag,
+                                       __gnu_pbds::tree_order_statistics_node_update>;
+
+    uint64_t threshold;
+    size_t max_tracked;
+    uint64_t clock;
+    time_tree times;
+    std::unordered_map<long, uint64_t> last_access;
+    std::set<std::pair<uint64_t, long>> by_hash;
+
+    /* Weighted stack distances; bucketed the same as "Histogram" */
+    Histogram buckets;
+    std::vector<double> distances;
+    double cold_misses;
+    double references;
+    uint64_t total;
+
+    /**
+     * @brief Lowers the threshold to the largest tracked hash, and stops
+     * tracking every value with that hash
+     */
+    void evict() {
+        threshold = std::prev(by_hash.end())->first;
+        while (!by_hash.empty() &&
+               std::prev(by_hash.end())->first >= threshold) {
+            auto it = std::prev(by_hash.end());
+            auto la = last_access.find(it->second);
+            times.erase(la->second);
+            last_access.erase(la);
+            by_hash.erase(it);
+        }
+    }
+
+public:
+
+    /**
+     * @param rate Initial sampling rate, in (0,1]
+     * @param max_tracked Maximum number of tracked values (0: unlimited)
+     */
+    MissRatioCurve(double rate = 1, size_t max_tracked = 0)
+    : max_tracked(max_tracked),
+      clock(0),
+      cold_misses(0),
+      references(0),
+      total(0)
+    {
+        if (rate <= 0 || rate > 1) {
+            throw errorf("Sampling rate must be within (0,1], got %lf", rate);
+        }
+        threshold = rate * modulus;
+    }
+
+    /**
+     * @brief Processes a single reference
+     */
+    void access(long value) {
+        uint64_t h = hash64(value) % modulus;
+        total++;
+        if (h >= threshold) {
+            return;
+        }
+
+        double scale = (double)modulus / threshold;
+        references += scale;
+        uint64_t now = clock++;
+
+        auto it = last_access.find(value);
+        if (it == last_access.end()) {
+            cold_misses += scale;
+            last_access[value] = now;
+            times.insert(now);
+            if (max_tracked) {
+                by_hash.insert(std::make_pair(h, value));
+                if (last_access.size() > max_tracked) {
+                    evict();
+                }
+            }
+            return;
+        }
+
+        /* Number of distinct values accessed since the last access */
+        uint64_t distance = times.size() - times.order_of_key(it->second) - 1;
+        size_t idx = buckets.index_of(distance * scale);
+        if (idx >= distances.size()) {
+            distances.resize(idx + 1);
+        }
+        distances[idx] += scale;
+
+        times.erase(it->second);
+        times.insert(now);
+        it->second = now;
+    }
+
+    /**
+     * @brief Returns the current sampling rate
+     */
+    double rate() const {
+        return (double)threshold / modulus;
+    }
+
+    /**
+     * @brief Returns the number of tracked values
+     */
+    size_t tracked() const {
+        return last_access.size();
+    }
+
+    /**
+     * @brief Calls "func(cache_size, miss_ratio)" for cache sizes growing
+     * by a factor of "factor" up to the largest observed distance
+     */
+    template <typename F>
+    void for_each_point(F func, double factor = 1.1) const {
+        if (references == 0) {
+            return;
+        }
+        /* hits[i]: weight of references with distance below bucket i */
+        std::vector<double> hits(distances.size() + 1, 0);
+        for (size_t i=0; i<distances.size(); ++i) {
+            hits[i+1] = hits[i] + distances[i];
+        }
+        /* SHARDS-adj: credit the sampling error to the first bucket */
+        double adjust = total - references;
+        for (size_t i=1; i<hits.size(); ++i) {
+            hits[i] += adjust;
+        }
+        uint64_t last = distances.empty() ? 1 :
+                        buckets.highest_of(distances.size() - 1) + 1;
+        double size = 1;
+        uint64_t previous = 0;
+        while (true) {
+            uint64_t cache = llround(size);
+            size *= factor;
+            if (cache == previous) {
+                continue;
+            }
+            previous = cache;
+            /* An LRU cache of "cache" entries hits every distance < cache */
+            size_t idx = buckets.index_of(cache);
+            double miss = 1 - hits[idx < hits.size() ? idx : hits.size()-1] /
+                              total;
+            func(cache, miss < 0 ? 0 : miss);
+            if (cache >= last) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Writes "cache-size miss-ratio" lines (see "for_each_point")
+     */
+    void write(std::ostream& os, double factor = 1.1) const {
+        for_each_point([&](uint64_t cache, double miss) {
+            os << cache << " " << miss << std::endl;
+        }, factor);
+    }
+};
+
+#endif
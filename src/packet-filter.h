@@ -0,0 +1,252 @@
+#ifndef PACKET_FILTER_H
+#define PACKET_FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <pcap/pcap.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "errorf.h"
+#include "flow-keys.h"
+
+/**
+ * @brief User packet filter (BPF syntax). Conjunctions of simple
+ * predicates are evaluated natively on the decoded fields:
+ *   tcp | udp | icmp | ip | ip6 | ip proto N
+ *   [src|dst] net A.B.C.D/LEN | [src|dst] host A.B.C.D | [src|dst] port N
+ * joined with "and" or "&&". Any other expression is compiled by libpcap
+ * and evaluated on the raw frame with pcap_offline_filter. As with BPF,
+ * "ip", "ip proto", "net" and "host" only match IPv4 packets, "ip6" only
+ * IPv6 packets.
+ */
+class PacketFilter {
+
+    enum direction { ANY, SRC, DST };
+    enum kind { VERSION, PROTO, NET, PORT };
+
+    struct predicate {
+        kind type;
+        direction dir;
+        uint32_t value;
+        uint32_t mask;
+    };
+
+    std::string expression;
+    std::vector<predicate> predicates;
+    bool native;
+
+    struct bpf_program program;
+    int program_linktype;
+    bool compiled;
+
+    static bool parse_number(const std::string& s, uint32_t max, uint32_t& out) {
+        char* end;
+        unsigned long v = strtoul(s.c_str(), &end, 10);
+        if (s.empty() || *end || v > max) {
+            return false;
+        }
+        out = v;
+        return true;
+    }
+
+    static bool parse_address(const std::string& s, uint32_t& addr) {
+        struct in_addr a;
+        if (inet_pton(AF_INET, s.c_str(), &a) != 1) {
+            return false;
+        }
+        addr = ntohl(a.s_addr);
+        return true;
+    }
+
+    /**
+     * @brief Parses "expression" into native predicates; returns false if
+     * it uses anything else
+     */
+    bool parse() {
+        std::vector<std::string> tokens;
+        std::stringstream ss(expression);
+        std::string token;
+        while (ss >> token) {
+            tokens.push_back(token);
+        }
+
+        size_t i = 0;
+        while (i < tokens.size()) {
+            predicate p;
+            p.dir = ANY;
+            p.mask = ~0U;
+
+            if (tokens[i] == "src" || tokens[i] == "dst") {
+                p.dir = tokens[i] == "src" ? SRC : DST;
+                if (++i == tokens.size()) {
+                    return false;
+                }
+            }
+
+            const std::string& word = tokens[i++];
+            std::string arg = i < tokens.size() ? tokens[i] : "";
+
+            if (p.dir == ANY && (word == "tcp" || word == "udp" ||
+                                 word == "icmp"))
+            {
+                p.type = PROTO;
+                p.value = word == "tcp" ? 6 : word == "udp" ? 17 : 1;
+            } else if (p.dir == ANY && (word == "ip" || word == "ip6") &&
+                       arg != "proto") {
+                p.type = VERSION;
+                p.value = word == "ip" ? 4 : 6;
+            } else if (p.dir == ANY && word == "ip") {
+                /* "ip proto N": IPv4, then the protocol */
+                p.type = VERSION;
+                p.value = 4;
+                predicates.push_back(p);
+                p.type = PROTO;
+                if (++i == tokens.size() ||
+                    !parse_number(tokens[i++], 255, p.value))
+                {
+                    return false;
+                }
+            } else if (word == "host" || word == "net") {
+                p.type = NET;
+                i++;
+                size_t slash = arg.find('/');
+                uint32_t len = 32;
+                if (slash != std::string::npos) {
+                    if (word == "host" ||
+                        !parse_number(arg.substr(slash + 1), 32, len))
+                    {
+                        return false;
+                    }
+                    arg = arg.substr(0, slash);
+                }
+                if (!parse_address(arg, p.value)) {
+                    return false;
+                }
+                p.mask = len == 0 ? 0 : (~0U << (32 - len));
+                p.value &= p.mask;
+            } else if (word == "port") {
+                p.type = PORT;
+                i++;
+                if (!parse_number(arg, 65535, p.value)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+            predicates.push_back(p);
+
+            if (i < tokens.size()) {
+                if (tokens[i] != "and" && tokens[i] != "&&") {
+                    return false;
+                }
+                if (++i == tokens.size()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool test(const predicate& p, uint32_t src, uint32_t dst) {
+        return (p.dir != DST && (src & p.mask) == p.value) ||
+               (p.dir != SRC && (dst & p.mask) == p.value);
+    }
+
+    PacketFilter(const PacketFilter&) = delete;
+    PacketFilter& operator=(const PacketFilter&) = delete;
+
+public:
+
+    PacketFilter(const std::string& expression)
+    : expression(expression), program_linktype(-1), compiled(false)
+    {
+        native = parse();
+        if (!native) {
+            predicates.clear();
+        }
+    }
+
+    ~PacketFilter() {
+        if (compiled) {
+            pcap_freecode(&program);
+        }
+    }
+
+    /**
+     * @brief Returns true if this is evaluated on decoded fields
+     */
+    bool is_native() const {
+        return native;
+    }
+
+    const std::string& get_expression() const {
+        return expression;
+    }
+
+    /**
+     * @brief Native evaluation on decoded fields
+     */
+    bool match(const packet_fields& f) const {
+        for (auto& p : predicates) {
+            bool ok;
+            switch (p.type) {
+            case VERSION:
+                ok = f.version == p.value;
+                break;
+            case PROTO:
+                ok = f.protocol == p.value;
+                break;
+            case NET:
+                ok = f.version == 4 && test(p, f.ip_src, f.ip_dst);
+                break;
+            default:
+                ok = (f.protocol == 6 || f.protocol == 17) &&
+                     test(p, f.port_src, f.port_dst);
+                break;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Compiles the BPF program for frames of link-layer "dlt"
+     * (libpcap DLT_* value); does nothing if already compiled for it
+     */
+    void compile(int dlt) {
+        if (compiled && program_linktype == dlt) {
+            return;
+        }
+        if (compiled) {
+            pcap_freecode(&program);
+            compiled = false;
+        }
+        pcap_t* p = pcap_open_dead(dlt, 65535);
+        if (PCAP_ERROR == pcap_compile(p, &program, expression.c_str(), 1,
+                                       PCAP_NETMASK_UNKNOWN))
+        {
+            std::string error = pcap_geterr(p);
+            pcap_close(p);
+            throw errorf("Cannot compile filter \"%s\": %s",
+                         expression.c_str(), error.c_str());
+        }
+        pcap_close(p);
+        program_linktype = dlt;
+        compiled = true;
+    }
+
+    /**
+     * @brief BPF evaluation on a raw frame; requires "compile"
+     */
+    bool match(const struct pcap_pkthdr* h, const u_char* bytes) const {
+        return pcap_offline_filter(&program, h, bytes) != 0;
+    }
+};
+
+#endif
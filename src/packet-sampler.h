@@ -0,0 +1,128 @@
+#ifndef PACKET_SAMPLER_H
+#define PACKET_SAMPLER_H
+
+#include <stdint.h>
+
+#include "errorf.h"
+#include "hash.h"
+
+/**
+ * @brief Parse-time packet sampling, applied by "PcapReader" before flow
+ * lookup so that rejected packets cost no more than their decoding. Any
+ * combination of the following modes may be enabled; a packet is kept if
+ * every enabled mode keeps it.
+ *
+ * - Time slices: keeps packets whose timestamp modulo "period" is below
+ *   "slice" (usec), i.e. the first "slice" usec of every period, aligned
+ *   to the epoch so that slices match across files. Checked first, on the
+ *   record header.
+ * - Flow hash: keeps the flows whose hashed key falls below "rate", with
+ *   all their packets (flow-consistent).
+ * - 1-in-N: keeps every Nth packet among those kept by the other modes,
+ *   starting with the first.
+ */
+class PacketSampler {
+
+    uint64_t every;
+    uint64_t counter;
+    uint64_t flow_threshold;
+    uint64_t seed;
+    bool flow_sampling;
+    int64_t slice;
+    int64_t period;
+
+public:
+
+    PacketSampler()
+    : every(1), counter(0), flow_threshold(0), seed(0),
+      flow_sampling(false), slice(0), period(0)
+    {}
+
+    /**
+     * @brief Keeps one packet in "n"
+     */
+    void set_every(uint64_t n) {
+        if (n == 0) {
+            throw errorf("1-in-N sampling requires N > 0");
+        }
+        every = n;
+    }
+
+    /**
+     * @brief Keeps the fraction "rate" in (0,1] of the flows
+     * @param seed Selects which flows are kept
+     */
+    void set_flow_rate(double rate, uint64_t seed = 0) {
+        if (rate <= 0 || rate > 1) {
+            throw errorf("Flow sampling rate must be in (0,1], got %lf", rate);
+        }
+        flow_sampling = rate < 1;
+        /* rate * 2^64 is below 2^64 for rate < 1, and fits */
+        flow_threshold = flow_sampling ? (uint64_t)(rate * 0x1p64) :
+                                         UINT64_MAX;
+        this->seed = hash64(seed);
+    }
+
+    /**
+     * @brief Keeps the first "slice" usec of every "period" usec
+     */
+    void set_time_slice(int64_t slice, int64_t period) {
+        if (slice <= 0 || period <= 0 || slice > period) {
+            throw errorf("Time slices require 0 < slice <= period");
+        }
+        this->slice = slice;
+        this->period = period;
+    }
+
+    /**
+     * @brief Returns true if a packet at "timestamp" (usec) is in a slice
+     */
+    bool keep_time(int64_t timestamp) const {
+        if (!period) {
+            return true;
+        }
+        int64_t phase = timestamp % period;
+        if (phase < 0) {
+            phase += period;
+        }
+        return phase < slice;
+    }
+
+    /**
+     * @brief Returns true if the flow with key hash "hash" is kept
+     */
+    bool keep_flow(uint64_t hash) const {
+        return !flow_sampling || hash64(hash ^ seed) <= flow_threshold;
+    }
+
+    /**
+     * @brief Returns true if whether a packet is kept depends on the
+     * packets before it (1-in-N sampling)
+     */
+    bool stateful() const {
+        return every != 1;
+    }
+
+    /**
+     * @brief Returns a hash of the enabled modes and their parameters
+     */
+    uint64_t config_hash() const {
+        uint64_t h = hash64(every);
+        h = hash64(h ^ (flow_sampling ? flow_threshold : 0));
+        h = hash64(h ^ (flow_sampling ? seed : 0));
+        h = hash64(h ^ slice);
+        return hash64(h ^ period);
+    }
+
+    /**
+     * @brief Counts a packet, returns true if it is the Nth
+     */
+    bool keep_packet() {
+        if (every == 1) {
+            return true;
+        }
+        return counter++ % every == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,15 @@
+#include "page-allocator.h"
+
+page_mode&
+current_page_mode()
+{
+    static page_mode mode = PAGE_MODE_DEFAULT;
+    return mode;
+}
+
+memory_stats&
+get_memory_stats()
+{
+    static memory_stats stats;
+    return stats;
+}
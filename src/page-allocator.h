@@ -0,0 +1,454 @@
+#ifndef PAGE_ALLOCATOR_H
+#define PAGE_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "errorf.h"
+
+/*
+ * Backing memory for the large flat tables (flow tables) and the column
+ * buffers of the trace store. Blocks come from malloc (default), from
+ * anonymous mappings aligned to 2 MB and advised with MADV_HUGEPAGE
+ * (transparent huge pages), or from MAP_HUGETLB mappings (explicit huge
+ * pages, which must be reserved in /proc/sys/vm/nr_hugepages; if none are
+ * left the block falls back to transparent huge pages).
+ *
+ * The mode is selected at runtime with "set_page_mode" and applies to new
+ * blocks; every block remembers how it was allocated.
+ */
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+enum page_mode {
+    PAGE_MODE_DEFAULT,
+    PAGE_MODE_TRANSPARENT,
+    PAGE_MODE_EXPLICIT
+};
+
+/**
+ * @brief Allocation statistics of all page blocks and arenas
+ */
+struct memory_stats {
+    std::atomic<size_t> blocks;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> peak_bytes;
+    std::atomic<size_t> transparent_bytes;
+    std::atomic<size_t> explicit_bytes;
+    std::atomic<size_t> explicit_fallbacks;
+    std::atomic<size_t> arena_allocations;
+    std::atomic<size_t> arena_reuses;
+};
+
+/* Defined in page-allocator.cpp and exported, so that the page mode set
+ * by the tools applies in libpcap-analyzer.so and its blocks are counted
+ * in the same stats */
+__attribute__((visibility("default"))) page_mode& current_page_mode();
+
+__attribute__((visibility("default"))) memory_stats& get_memory_stats();
+
+/**
+ * @brief Sets how new blocks are backed
+ */
+inline void
+set_page_mode(page_mode mode)
+{
+    current_page_mode() = mode;
+}
+
+/**
+ * @brief Parses a page mode name: "default", "thp" or "hugetlb"
+ */
+inline page_mode
+parse_page_mode(const std::string& name)
+{
+    if (name == "default") {
+        return PAGE_MODE_DEFAULT;
+    } else if (name == "thp") {
+        return PAGE_MODE_TRANSPARENT;
+    } else if (name == "hugetlb") {
+        return PAGE_MODE_EXPLICIT;
+    }
+    throw errorf("Unknown page mode \"%s\" (default, thp or hugetlb)",
+                 name.c_str());
+}
+
+inline const char*
+page_mode_name(page_mode mode)
+{
+    static const char* names[] = {"default", "thp", "hugetlb"};
+    return names[mode];
+}
+
+/**
+ * @brief A block of memory and how it was allocated
+ */
+struct page_block {
+    void* data;
+    size_t bytes;
+    page_mode mode;
+};
+
+/**
+ * @brief Allocates at least "bytes" bytes. Huge page blocks are rounded up
+ * to 2 MB; "bytes" of the result is the usable size.
+ */
+inline page_block
+alloc_pages(size_t bytes)
+{
+    memory_stats& stats = get_memory_stats();
+    page_block block = {NULL, bytes, current_page_mode()};
+
+    if (block.mode != PAGE_MODE_DEFAULT) {
+        block.bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+                      HUGE_PAGE_SIZE;
+    }
+
+    if (block.mode == PAGE_MODE_EXPLICIT) {
+        void* p = mmap(NULL, block.bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            block.data = p;
+            stats.explicit_bytes += block.bytes;
+        } else {
+            stats.explicit_fallbacks++;
+            block.mode = PAGE_MODE_TRANSPARENT;
+        }
+    }
+
+    if (block.mode == PAGE_MODE_TRANSPARENT) {
+        /* Over-map to align the block to 2 MB, then trim both ends */
+        size_t length = block.bytes + HUGE_PAGE_SIZE;
+        char* p = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* aligned = (char*)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) &
+                                ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        if (aligned > p) {
+            munmap(p, aligned - p);
+        }
+        size_t tail = (p + length) - (aligned + block.bytes);
+        if (tail) {
+            munmap(aligned + block.bytes, tail);
+        }
+        madvise(aligned, block.bytes, MADV_HUGEPAGE);
+        block.data = aligned;
+        stats.transparent_bytes += block.bytes;
+    }
+
+    if (block.mode == PAGE_MODE_DEFAULT) {
+        block.data = malloc(block.bytes ? block.bytes : 1);
+        if (!block.data) {
+            throw std::bad_alloc();
+        }
+    }
+
+    stats.blocks++;
+    size_t current = stats.bytes += block.bytes;
+    size_t peak = stats.peak_bytes;
+    while (current > peak &&
+           !stats.peak_bytes.compare_exchange_weak(peak, current)) {
+    }
+    return block;
+}
+
+/**
+ * @brief Frees a block returned by "alloc_pages"
+ */
+inline void
+free_pages(const page_block& block)
+{
+    if (!block.data) {
+        return;
+    }
+    memory_stats& stats = get_memory_stats();
+    stats.blocks--;
+    stats.bytes -= block.bytes;
+    if (block.mode == PAGE_MODE_DEFAULT) {
+        free(block.data);
+    } else {
+        munmap(block.data, block.bytes);
+        if (block.mode == PAGE_MODE_EXPLICIT) {
+            stats.explicit_bytes -= block.bytes;
+        } else {
+            stats.transparent_bytes -= block.bytes;
+        }
+    }
+}
+
+/**
+ * @brief Returns the bytes of this process backed by transparent huge
+ * pages (AnonHugePages in /proc/self/smaps_rollup), or -1 if unknown
+ */
+inline long
+anon_huge_pages_bytes()
+{
+    std::ifstream is("/proc/self/smaps_rollup");
+    std::string key;
+    long value;
+    while (is >> key) {
+        if (key == "AnonHugePages:" && is >> value) {
+            return value << 10;
+        }
+        is.ignore(1 << 20, '\n');
+    }
+    return -1;
+}
+
+/**
+ * @brief Writes the allocation statistics to "os"; arena counts cover the
+ * arenas destroyed so far
+ */
+inline void
+write_memory_stats(std::ostream& os)
+{
+    memory_stats& stats = get_memory_stats();
+    os << "Page mode: " << page_mode_name(current_page_mode()) << std::endl
+       << "Page blocks: " << stats.blocks << " ("
+       << (stats.bytes >> 10) << " KB, peak "
+       << (stats.peak_bytes >> 10) << " KB)" << std::endl
+       << "Transparent huge page blocks: "
+       << (stats.transparent_bytes >> 10) << " KB advised" << std::endl
+       << "Explicit huge page blocks: "
+       << (stats.explicit_bytes >> 10) << " KB ("
+       << stats.explicit_fallbacks << " fell back to THP)" << std::endl
+       << "Arena allocations: " << stats.arena_allocations << " ("
+       << stats.arena_reuses << " from free lists)" << std::endl;
+    long huge = anon_huge_pages_bytes();
+    if (huge >= 0) {
+        os << "AnonHugePages: " << (huge >> 10) << " KB" << std::endl;
+    }
+}
+
+/**
+ * @brief Fixed-size array of trivially constructible elements in a page
+ * block (uninitialized)
+ */
+template <typename T>
+class PageArray {
+
+    page_block block;
+    size_t count;
+
+    PageArray(const PageArray&) = delete;
+    PageArray& operator=(const PageArray&) = delete;
+
+public:
+
+    PageArray(size_t count = 0)
+    : block(alloc_pages(count * sizeof(T))), count(count)
+    {}
+
+    PageArray(PageArray&& other)
+    : block(other.block), count(other.count)
+    {
+        other.block.data = NULL;
+        other.count = 0;
+    }
+
+    ~PageArray() {
+        free_pages(block);
+    }
+
+    void swap(PageArray& other) {
+        std::swap(block, other.block);
+        std::swap(count, other.count);
+    }
+
+    T& operator[](size_t idx) {
+        return ((T*)block.data)[idx];
+    }
+
+    const T& operator[](size_t idx) const {
+        return ((const T*)block.data)[idx];
+    }
+
+    T* data() {
+        return (T*)block.data;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        return block.bytes;
+    }
+};
+
+/**
+ * @brief Bump allocator over page blocks, for many small objects that are
+ * allocated together (per-flow data, column chunks). Freed objects of up
+ * to 256 bytes are kept in per-size free lists for reuse; everything is
+ * released with the arena. Not thread safe.
+ */
+class Arena {
+
+    static const size_t granularity = 16;
+    static const size_t max_class = 256;
+
+    size_t block_size;
+    std::vector<page_block> blocks;
+    char* cursor;
+    char* end;
+    void* free_lists[max_class / granularity + 1];
+    /* Added to "get_memory_stats()" on destruction, so that arenas of
+     * different threads do not share a counter */
+    size_t allocations;
+    size_t reuses;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+public:
+
+    /**
+     * @param block_size Bytes per block (rounded up to 2 MB with huge
+     * pages)
+     */
+    Arena(size_t block_size = HUGE_PAGE_SIZE)
+    : block_size(block_size), cursor(NULL), end(NULL), allocations(0),
+      reuses(0)
+    {
+        memset(free_lists, 0, sizeof(free_lists));
+    }
+
+    Arena(Arena&& other)
+    : block_size(other.block_size), blocks(std::move(other.blocks)),
+      cursor(other.cursor), end(other.end), allocations(other.allocations),
+      reuses(other.reuses)
+    {
+        memcpy(free_lists, other.free_lists, sizeof(free_lists));
+        other.blocks.clear();
+        other.cursor = other.end = NULL;
+        other.allocations = other.reuses = 0;
+        memset(other.free_lists, 0, sizeof(other.free_lists));
+    }
+
+    ~Arena() {
+        memory_stats& stats = get_memory_stats();
+        stats.arena_allocations += allocations;
+        stats.arena_reuses += reuses;
+        for (auto& block : blocks) {
+            free_pages(block);
+        }
+    }
+
+    /**
+     * @brief Returns "bytes" bytes aligned to "align" (at most 16 for
+     * objects that may be reused from free lists)
+     */
+    void* allocate(size_t bytes, size_t align = granularity) {
+        allocations++;
+        size_t size = (bytes + granularity - 1) / granularity * granularity;
+        if (size <= max_class && free_lists[size / granularity]) {
+            void* p = free_lists[size / granularity];
+            free_lists[size / granularity] = *(void**)p;
+            reuses++;
+            return p;
+        }
+        char* p = (char*)(((uintptr_t)cursor + align - 1) &
+                          ~(uintptr_t)(align - 1));
+        if (!cursor || p + size > end) {
+            page_block block = alloc_pages(std::max(block_size, size + align));
+            blocks.push_back(block);
+            cursor = (char*)block.data;
+            end = cursor + block.bytes;
+            p = (char*)(((uintptr_t)cursor + align - 1) &
+                        ~(uintptr_t)(align - 1));
+        }
+        cursor = p + size;
+        return p;
+    }
+
+    /**
+     * @brief Returns an object of "bytes" bytes to its free list
+     */
+    void deallocate(void* p, size_t bytes) {
+        size_t size = (bytes + granularity - 1) / granularity * granularity;
+        if (size <= max_class) {
+            *(void**)p = free_lists[size / granularity];
+            free_lists[size / granularity] = p;
+        }
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        size_t total = 0;
+        for (auto& block : blocks) {
+            total += block.bytes;
+        }
+        return total;
+    }
+};
+
+/**
+ * @brief STL allocator over an "Arena", for node based containers: nodes
+ * come from the arena, large arrays (hash buckets) from the heap
+ */
+template <typename T>
+class ArenaAllocator {
+
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* arena;
+
+public:
+
+    using value_type = T;
+
+    ArenaAllocator(Arena* arena)
+    : arena(arena)
+    {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+    : arena(other.arena)
+    {}
+
+    T* allocate(size_t n) {
+        if (n * sizeof(T) <= 256) {
+            return (T*)arena->allocate(n * sizeof(T));
+        }
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n * sizeof(T) <= 256) {
+            arena->deallocate(p, n * sizeof(T));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+#endif
@@ -0,0 +1,604 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pcap-analyzer-api.h"
+#include "errorf.h"
+#include "pcap-utils.h"
+#include "trace-file.h"
+#include "locality-window.h"
+#include "miss-ratio-curve.h"
+#include "cache-sim.h"
+
+static_assert(sizeof(pa_tuple) == sizeof(std::array<uint32_t, 5>),
+              "pa_tuple must match the tuples column");
+static_assert(sizeof(pa_addresses6) == sizeof(std::array<uint8_t, 32>),
+              "pa_addresses6 must match the IPv6 addresses column");
+
+/* Message of the last error, per thread */
+static thread_local std::string last_error;
+
+/**
+ * @brief Runs "func" and returns its result, or "fail" if it throws (the
+ * message is kept for "pa_error"). No exception crosses the C interface.
+ */
+template <typename R, typename F>
+static R
+guard(R fail, F func)
+{
+    try {
+        return func();
+    } catch (std::exception& e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "Unknown error";
+    }
+    return fail;
+}
+
+/**
+ * @brief Returns the packet count of "pa_reader_read" as taken by
+ * "PcapReader" (any negative value: all); throws if it does not fit
+ */
+static int
+read_count(long count)
+{
+    if (count > INT_MAX) {
+        throw errorf("Packet count %ld is above %d", count, INT_MAX);
+    }
+    return count < 0 ? -1 : (int)count;
+}
+
+/**
+ * @brief Reader of any flow key; "pa_reader" hides the key type
+ */
+struct pa_reader {
+
+    virtual ~pa_reader() {}
+
+    virtual size_t keys() const = 0;
+    virtual const char* key_name(size_t key) const = 0;
+    virtual void add_key(const char* flow_key) = 0;
+    virtual void set_filter(const char* expression) = 0;
+    virtual bool native_filter() const = 0;
+    virtual void set_time_range(int64_t from, int64_t to) = 0;
+    virtual void set_read_ahead(const read_ahead_options& options) = 0;
+    virtual void enable_index() = 0;
+    virtual void enable_cache(uint64_t max_bytes) = 0;
+    virtual bool cached() const = 0;
+    virtual PacketSampler& get_sampler() = 0;
+    virtual void enable_histograms() = 0;
+    virtual size_t load_flow_dict(size_t key, const char* filename) = 0;
+    virtual void save_flow_dict(size_t key, const char* filename) const = 0;
+    virtual void read(const char* filename, int count) = 0;
+    virtual void read_merged(const std::vector<std::string>& filenames,
+                             int count) = 0;
+    virtual size_t flows(size_t key) const = 0;
+    virtual const ChunkedColumn<uint32_t>& get_locality(size_t key) const = 0;
+    virtual const TraceStore& get_trace() const = 0;
+    virtual void write_histograms(std::ostream& os) const = 0;
+};
+
+template <typename Key>
+class KeyedReader : public pa_reader {
+
+    PcapReader<Key> reader;
+
+    const LocalityStream& stream(size_t key) const {
+        return *reader.get_locality_streams().at(key - 1);
+    }
+
+    LocalityStream& stream(size_t key) {
+        return *reader.get_locality_streams().at(key - 1);
+    }
+
+public:
+
+    size_t keys() const {
+        return reader.get_locality_streams().size() + 1;
+    }
+
+    const char* key_name(size_t key) const {
+        return key ? stream(key).name() : Key::name();
+    }
+
+    void add_key(const char* flow_key) {
+        reader.add_locality_stream(flow_key);
+    }
+
+    void set_filter(const char* expression) {
+        reader.set_filter(expression);
+    }
+
+    bool native_filter() const {
+        return reader.native_filter();
+    }
+
+    void set_time_range(int64_t from, int64_t to) {
+        reader.set_time_range(from, to);
+    }
+
+    void set_read_ahead(const read_ahead_options& options) {
+        reader.set_read_ahead(options);
+    }
+
+    void enable_index() {
+        reader.enable_index();
+    }
+
+    void enable_cache(uint64_t max_bytes) {
+        reader.enable_cache(max_bytes);
+    }
+
+    bool cached() const {
+        return reader.cached();
+    }
+
+    PacketSampler& get_sampler() {
+        return reader.get_sampler();
+    }
+
+    void enable_histograms() {
+        reader.enable_histograms();
+    }
+
+    size_t load_flow_dict(size_t key, const char* filename) {
+        return key ? stream(key).load_flow_dict(filename) :
+                     reader.load_flow_dict(filename);
+    }
+
+    void save_flow_dict(size_t key, const char* filename) const {
+        if (key) {
+            stream(key).save_flow_dict(filename);
+        } else {
+            reader.save_flow_dict(filename);
+        }
+    }
+
+    void read(const char* filename, int count) {
+        reader.read(filename, count);
+    }
+
+    void read_merged(const std::vector<std::string>& filenames, int count) {
+        reader.read_merged(filenames, count);
+    }
+
+    size_t flows(size_t key) const {
+        return key ? stream(key).flows() : reader.get_trace().get_tuples().size();
+    }
+
+    const ChunkedColumn<uint32_t>& get_locality(size_t key) const {
+        return key ? stream(key).get_locality() : reader.get_locality();
+    }
+
+    const TraceStore& get_trace() const {
+        return reader.get_trace();
+    }
+
+    void write_histograms(std::ostream& os) const {
+        reader.get_size_histogram().write(os, "packet-size");
+        reader.get_ipd_histogram().write(os, "inter-packet-delay");
+        reader.get_flow_iat_histogram().write(os, "flow-inter-arrival");
+    }
+};
+
+/**
+ * @brief Calls "func" with the column "column" of "reader"
+ */
+template <typename F>
+static auto
+with_column(const pa_reader* reader, int column, size_t key, F func)
+        -> decltype(func(reader->get_trace().get_sizes()))
+{
+    if (key >= reader->keys()) {
+        throw errorf("Invalid key %lu", key);
+    }
+    switch (column) {
+    case PA_COLUMN_FLOWS:
+        return func(reader->get_locality(key));
+    case PA_COLUMN_SIZES:
+        return func(reader->get_trace().get_sizes());
+    case PA_COLUMN_TIMES:
+        return func(reader->get_trace().get_times());
+    case PA_COLUMN_TUPLES:
+        return func(reader->get_trace().get_tuples());
+    case PA_COLUMN_ADDRESSES6:
+        return func(reader->get_trace().get_addresses6());
+    }
+    throw errorf("Invalid column %d", column);
+}
+
+/* A trace file, or the cache of a pcap file */
+struct pa_trace {
+    std::unique_ptr<TraceFile> file;
+    std::unique_ptr<TraceCacheFile> cache;
+
+    pa_trace(const char* filename) {
+        if (!is_trace_file(filename) && TraceCacheFile::is_valid(filename)) {
+            cache.reset(new TraceCacheFile(filename));
+        } else {
+            file.reset(new TraceFile(filename));
+        }
+    }
+};
+
+struct pa_series {
+    size_t rows;
+    std::vector<std::vector<double>> columns;
+};
+
+extern "C" {
+
+int
+pa_version(void)
+{
+    return (PA_VERSION_MAJOR << 16) | PA_VERSION_MINOR;
+}
+
+const char*
+pa_error(void)
+{
+    return last_error.c_str();
+}
+
+pa_reader*
+pa_reader_open(const char* flow_key)
+{
+    return guard<pa_reader*>(NULL, [&]() {
+        pa_reader* reader = NULL;
+        dispatch_flow_key(flow_key, [&](auto key) {
+            reader = new KeyedReader<decltype(key)>();
+        });
+        return reader;
+    });
+}
+
+void
+pa_reader_close(pa_reader* reader)
+{
+    delete reader;
+}
+
+int
+pa_reader_add_key(pa_reader* reader, const char* flow_key)
+{
+    return guard(-1, [&]() {
+        reader->add_key(flow_key);
+        return (int)reader->keys() - 1;
+    });
+}
+
+size_t
+pa_reader_keys(const pa_reader* reader)
+{
+    return reader->keys();
+}
+
+const char*
+pa_reader_key_name(const pa_reader* reader, size_t key)
+{
+    return key < reader->keys() ? reader->key_name(key) : NULL;
+}
+
+int
+pa_reader_set_filter(pa_reader* reader, const char* expression)
+{
+    return guard(-1, [&]() {
+        reader->set_filter(expression);
+        return 0;
+    });
+}
+
+int
+pa_reader_native_filter(const pa_reader* reader)
+{
+    return reader->native_filter();
+}
+
+int
+pa_reader_set_time_range(pa_reader* reader, int64_t from, int64_t to)
+{
+    reader->set_time_range(from, to);
+    return 0;
+}
+
+int
+pa_reader_set_read_ahead(pa_reader* reader, size_t block_size, int depth,
+                         int direct)
+{
+    return guard(-1, [&]() {
+        reader->set_read_ahead(read_ahead_options(block_size, depth, direct));
+        return 0;
+    });
+}
+
+int
+pa_reader_enable_index(pa_reader* reader)
+{
+    reader->enable_index();
+    return 0;
+}
+
+int
+pa_reader_enable_cache(pa_reader* reader, uint64_t max_bytes)
+{
+    reader->enable_cache(max_bytes);
+    return 0;
+}
+
+int
+pa_reader_cached(const pa_reader* reader)
+{
+    return reader->cached();
+}
+
+int
+pa_reader_sample_every(pa_reader* reader, uint64_t n)
+{
+    return guard(-1, [&]() {
+        reader->get_sampler().set_every(n);
+        return 0;
+    });
+}
+
+int
+pa_reader_sample_flows(pa_reader* reader, double rate, uint64_t seed)
+{
+    return guard(-1, [&]() {
+        reader->get_sampler().set_flow_rate(rate, seed);
+        return 0;
+    });
+}
+
+int
+pa_reader_sample_time(pa_reader* reader, int64_t slice, int64_t period)
+{
+    return guard(-1, [&]() {
+        reader->get_sampler().set_time_slice(slice, period);
+        return 0;
+    });
+}
+
+int
+pa_reader_enable_histograms(pa_reader* reader)
+{
+    reader->enable_histograms();
+    return 0;
+}
+
+long
+pa_reader_load_flow_dict(pa_reader* reader, size_t key, const char* filename)
+{
+    return guard(-1L, [&]() {
+        if (key >= reader->keys()) {
+            throw errorf("Invalid key %lu", key);
+        }
+        return (long)reader->load_flow_dict(key, filename);
+    });
+}
+
+int
+pa_reader_save_flow_dict(const pa_reader* reader, size_t key,
+                         const char* filename)
+{
+    return guard(-1, [&]() {
+        if (key >= reader->keys()) {
+            throw errorf("Invalid key %lu", key);
+        }
+        reader->save_flow_dict(key, filename);
+        return 0;
+    });
+}
+
+int
+pa_reader_read(pa_reader* reader, const char* filename, long count)
+{
+    return guard(-1, [&]() {
+        reader->read(filename, read_count(count));
+        return 0;
+    });
+}
+
+int
+pa_reader_read_merged(pa_reader* reader, const char* const* filenames,
+                      size_t n, long count)
+{
+    return guard(-1, [&]() {
+        reader->read_merged(std::vector<std::string>(filenames, filenames + n),
+                            read_count(count));
+        return 0;
+    });
+}
+
+size_t
+pa_reader_flows(const pa_reader* reader, size_t key)
+{
+    return key < reader->keys() ? reader->flows(key) : 0;
+}
+
+size_t
+pa_reader_memory(const pa_reader* reader)
+{
+    return reader->get_trace().memory();
+}
+
+size_t
+pa_reader_size(const pa_reader* reader, int column, size_t key)
+{
+    return guard((size_t)0, [&]() {
+        return with_column(reader, column, key, [](const auto& c) {
+            return c.size();
+        });
+    });
+}
+
+size_t
+pa_reader_chunks(const pa_reader* reader, int column, size_t key)
+{
+    return guard((size_t)0, [&]() {
+        return with_column(reader, column, key, [](const auto& c) {
+            return c.chunk_count();
+        });
+    });
+}
+
+const void*
+pa_reader_chunk(const pa_reader* reader, int column, size_t key,
+                size_t index, size_t* length)
+{
+    return guard<const void*>(NULL, [&]() {
+        return with_column(reader, column, key, [&](const auto& c) {
+            if (index >= c.chunk_count()) {
+                throw errorf("Invalid chunk %lu", index);
+            }
+            return (const void*)c.chunk(index, *length);
+        });
+    });
+}
+
+int
+pa_reader_write_histograms(const pa_reader* reader, const char* filename)
+{
+    return guard(-1, [&]() {
+        std::ofstream os(filename, std::ios_base::out | std::ios_base::trunc);
+        if (!os.is_open()) {
+            throw errorf("Cannot write to file \"%s\"", filename);
+        }
+        reader->write_histograms(os);
+        return 0;
+    });
+}
+
+int
+pa_reader_write_trace(const pa_reader* reader, size_t key,
+                      const char* filename)
+{
+    return guard(-1, [&]() {
+        if (key >= reader->keys()) {
+            throw errorf("Invalid key %lu", key);
+        }
+        write_trace_file(filename, reader->get_locality(key),
+                         reader->get_trace().get_times());
+        return 0;
+    });
+}
+
+pa_trace*
+pa_trace_open(const char* filename)
+{
+    return guard<pa_trace*>(NULL, [&]() {
+        return new pa_trace(filename);
+    });
+}
+
+void
+pa_trace_close(pa_trace* trace)
+{
+    delete trace;
+}
+
+size_t
+pa_trace_size(const pa_trace* trace)
+{
+    return trace->cache ? trace->cache->size() : trace->file->size();
+}
+
+const uint32_t*
+pa_trace_flows(const pa_trace* trace)
+{
+    return trace->cache ? trace->cache->flows() : trace->file->flows();
+}
+
+const int64_t*
+pa_trace_times(const pa_trace* trace)
+{
+    return trace->cache ? trace->cache->times() : trace->file->times();
+}
+
+pa_series*
+pa_locality_analyze(const uint32_t* flows, const int64_t* times,
+                    size_t count, int by_time, long window, long step,
+                    int hll_precision, int threads)
+{
+    return guard<pa_series*>(NULL, [&]() {
+        if (threads <= 0) {
+            threads = ThreadPool::shared().size();
+        }
+        std::unique_ptr<pa_series> series(new pa_series());
+        series->columns.resize(hll_precision > 0 ? 2 : 1);
+        analyze_locality_parallel(flows, times, count, by_time, window, step,
+                                  hll_precision, threads,
+                                  [&](const locality_row& row) {
+            series->columns[0].push_back(row.reuse);
+            if (hll_precision > 0) {
+                series->columns[1].push_back(row.distinct);
+            }
+        });
+        series->rows = series->columns[0].size();
+        return series.release();
+    });
+}
+
+pa_series*
+pa_miss_ratio_curve(const uint32_t* refs, size_t count, double rate,
+                    size_t max_tracked)
+{
+    return guard<pa_series*>(NULL, [&]() {
+        MissRatioCurve mrc(rate, max_tracked);
+        for (size_t i=0; i<count; ++i) {
+            mrc.access(refs[i]);
+        }
+        std::unique_ptr<pa_series> series(new pa_series());
+        series->columns.resize(2);
+        mrc.for_each_point([&](uint64_t cache, double miss) {
+            series->columns[0].push_back(cache);
+            series->columns[1].push_back(miss);
+        });
+        series->rows = series->columns[0].size();
+        return series.release();
+    });
+}
+
+int
+pa_cache_hits(const char* policy, size_t capacity, size_t ways,
+              const uint32_t* refs, size_t count, uint64_t* hits)
+{
+    return guard(-1, [&]() {
+        *hits = simulate_cache_policy(policy, capacity, ways, refs, count);
+        return 0;
+    });
+}
+
+void
+pa_series_free(pa_series* series)
+{
+    delete series;
+}
+
+size_t
+pa_series_rows(const pa_series* series)
+{
+    return series->rows;
+}
+
+size_t
+pa_series_columns(const pa_series* series)
+{
+    return series->columns.size();
+}
+
+const double*
+pa_series_column(const pa_series* series, size_t column)
+{
+    if (column >= series->columns.size()) {
+        return NULL;
+    }
+    return series->columns[column].data();
+}
+
+}
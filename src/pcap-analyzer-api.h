@@ -0,0 +1,344 @@
+#ifndef PCAP_ANALYZER_API_H
+#define PCAP_ANALYZER_API_H
+
+/*
+ * C interface of the pcap analyzer library (libpcap-analyzer.so).
+ *
+ * Error handling: functions that return "int" return 0 on success and -1
+ * on error; functions that return a pointer return NULL on error. The
+ * message of the last error of the calling thread is returned by
+ * "pa_error".
+ *
+ * Ownership: every object is created by a "*_open" or analysis function
+ * and freed by the matching "*_close" / "*_free" function. Pointers
+ * returned by accessors point into memory owned by the object; they are
+ * never freed by the caller, and stay valid until the object is closed.
+ * Reader columns are stored in chunks that never move, so a chunk pointer
+ * stays valid across later reads (only the length of the last chunk
+ * grows; query it again after reading). Strings returned by the library
+ * follow the same rule.
+ *
+ * The ABI is stable within a major version, see "pa_version".
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define PA_API __attribute__((visibility("default")))
+#else
+#define PA_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PA_VERSION_MAJOR 1
+#define PA_VERSION_MINOR 2
+
+/**
+ * @brief Columns of a reader
+ */
+enum pa_column {
+    PA_COLUMN_FLOWS = 0,   /* uint32_t per packet: flow id of a key */
+    PA_COLUMN_SIZES = 1,   /* uint16_t per packet: bytes, saturated */
+    PA_COLUMN_TIMES = 2,   /* int64_t per packet: usec since the epoch */
+    PA_COLUMN_TUPLES = 3,  /* pa_tuple per flow id of the first key */
+    PA_COLUMN_ADDRESSES6 = 4 /* pa_addresses6 per flow id of the first key,
+                                or empty if no flow is IPv6 (since 1.1) */
+};
+
+/**
+ * @brief 5-tuple of a flow's first packet, in host byte order. IPv6 flows
+ * have zero addresses; see PA_COLUMN_ADDRESSES6.
+ */
+typedef struct pa_tuple {
+    uint32_t protocol;
+    uint32_t ip_src;
+    uint32_t ip_dst;
+    uint32_t port_src;
+    uint32_t port_dst;
+} pa_tuple;
+
+/**
+ * @brief IPv6 addresses of a flow, in network byte order (zero for IPv4
+ * flows)
+ */
+typedef struct pa_addresses6 {
+    uint8_t ip_src[16];
+    uint8_t ip_dst[16];
+} pa_addresses6;
+
+typedef struct pa_reader pa_reader;
+typedef struct pa_trace pa_trace;
+typedef struct pa_series pa_series;
+
+/**
+ * @brief Returns (PA_VERSION_MAJOR << 16) | PA_VERSION_MINOR of the library
+ */
+PA_API int pa_version(void);
+
+/**
+ * @brief Returns the message of the last error of the calling thread
+ */
+PA_API const char* pa_error(void);
+
+/* Reader: extracts the columns of pcap files */
+
+/**
+ * @brief Creates a reader with flows identified by the key "flow_key"
+ * (5-tuple, src-ip, dst-ip, src-dst, dst-24, proto-dport, 5-tuple-dual).
+ * Key 0 of the reader is "flow_key"; more keys are added with
+ * "pa_reader_add_key". IPv6 packets are only read if "flow_key" is
+ * dual stack (5-tuple-dual, proto-dport); all keys of such a reader must
+ * be dual stack.
+ */
+PA_API pa_reader* pa_reader_open(const char* flow_key);
+
+/**
+ * @brief Frees "reader" and all its columns
+ */
+PA_API void pa_reader_close(pa_reader* reader);
+
+/**
+ * @brief Also extracts the flow ids of "flow_key" from the same packets;
+ * returns the key index, or -1. Call before reading.
+ */
+PA_API int pa_reader_add_key(pa_reader* reader, const char* flow_key);
+
+/**
+ * @brief Returns the number of keys
+ */
+PA_API size_t pa_reader_keys(const pa_reader* reader);
+
+/**
+ * @brief Returns the name of key "key", or NULL
+ */
+PA_API const char* pa_reader_key_name(const pa_reader* reader, size_t key);
+
+/**
+ * @brief Only keeps packets that match the BPF "expression"
+ */
+PA_API int pa_reader_set_filter(pa_reader* reader, const char* expression);
+
+/**
+ * @brief Returns 1 if the filter is evaluated natively, 0 otherwise
+ */
+PA_API int pa_reader_native_filter(const pa_reader* reader);
+
+/**
+ * @brief Only reads packets with timestamps in [from, to) (usec)
+ */
+PA_API int pa_reader_set_time_range(pa_reader* reader, int64_t from,
+                                    int64_t to);
+
+/**
+ * @brief Reads classic pcap files with asynchronous read-ahead into
+ * "depth" buffers of "block_size" bytes, with O_DIRECT if "direct"
+ */
+PA_API int pa_reader_set_read_ahead(pa_reader* reader, size_t block_size,
+                                    int depth, int direct);
+
+/**
+ * @brief Writes a sidecar index for every classic pcap file read in full
+ */
+PA_API int pa_reader_enable_index(pa_reader* reader);
+
+/**
+ * @brief Loads every file read in full from its parsed-trace cache
+ * ("FILE.cache") if it is valid for the key and the options, instead of
+ * parsing it; otherwise writes the cache while reading, if it takes at
+ * most "max_bytes" (since 1.2)
+ */
+PA_API int pa_reader_enable_cache(pa_reader* reader, uint64_t max_bytes);
+
+/**
+ * @brief Returns 1 if the last "pa_reader_read" loaded a cache, 0
+ * otherwise (since 1.2)
+ */
+PA_API int pa_reader_cached(const pa_reader* reader);
+
+/**
+ * @brief Keeps one packet in "n"
+ */
+PA_API int pa_reader_sample_every(pa_reader* reader, uint64_t n);
+
+/**
+ * @brief Keeps the fraction "rate" in (0,1] of the flows, selected by "seed"
+ */
+PA_API int pa_reader_sample_flows(pa_reader* reader, double rate,
+                                  uint64_t seed);
+
+/**
+ * @brief Keeps the first "slice" usec of every "period" usec
+ */
+PA_API int pa_reader_sample_time(pa_reader* reader, int64_t slice,
+                                 int64_t period);
+
+/**
+ * @brief Collects the packet size, inter-packet delay and per-flow
+ * inter-arrival histograms. Call before reading.
+ */
+PA_API int pa_reader_enable_histograms(pa_reader* reader);
+
+/**
+ * @brief Continues the flow ids of key "key" from the flow dictionary
+ * "filename"; returns the number of flows loaded, or -1. Call before
+ * reading.
+ */
+PA_API long pa_reader_load_flow_dict(pa_reader* reader, size_t key,
+                                     const char* filename);
+
+/**
+ * @brief Saves the flows of key "key" to the dictionary "filename"
+ */
+PA_API int pa_reader_save_flow_dict(const pa_reader* reader, size_t key,
+                                    const char* filename);
+
+/**
+ * @brief Reads up to "count" IP packets (-1: all) of "filename"; fails if
+ * "count" is above INT_MAX
+ */
+PA_API int pa_reader_read(pa_reader* reader, const char* filename,
+                          long count);
+
+/**
+ * @brief Reads up to "count" IP packets (-1: all) of the "n" files
+ * "filenames", interleaved by timestamp; fails if "count" is above INT_MAX
+ */
+PA_API int pa_reader_read_merged(pa_reader* reader,
+                                 const char* const* filenames, size_t n,
+                                 long count);
+
+/**
+ * @brief Returns the number of flows of key "key"
+ */
+PA_API size_t pa_reader_flows(const pa_reader* reader, size_t key);
+
+/**
+ * @brief Returns the number of bytes held by the columns of key 0
+ */
+PA_API size_t pa_reader_memory(const pa_reader* reader);
+
+/**
+ * @brief Returns the number of elements of "column" ("key" selects the
+ * key of PA_COLUMN_FLOWS and is ignored otherwise)
+ */
+PA_API size_t pa_reader_size(const pa_reader* reader, int column,
+                             size_t key);
+
+/**
+ * @brief Returns the number of chunks of "column"
+ */
+PA_API size_t pa_reader_chunks(const pa_reader* reader, int column,
+                               size_t key);
+
+/**
+ * @brief Returns chunk "index" of "column" and sets "length" to its number
+ * of elements, or returns NULL. Elements are of the type of the column
+ * (see "pa_column"); the chunk is owned by the reader.
+ */
+PA_API const void* pa_reader_chunk(const pa_reader* reader, int column,
+                                   size_t key, size_t index, size_t* length);
+
+/**
+ * @brief Writes the histograms (see "pa_reader_enable_histograms") to
+ * "filename"
+ */
+PA_API int pa_reader_write_histograms(const pa_reader* reader,
+                                      const char* filename);
+
+/**
+ * @brief Writes the flow ids of key "key" and the timestamps to the binary
+ * trace file "filename"
+ */
+PA_API int pa_reader_write_trace(const pa_reader* reader, size_t key,
+                                 const char* filename);
+
+/* Trace: a binary trace file, mapped in memory */
+
+/**
+ * @brief Maps the binary trace file "filename", or the parsed-trace cache
+ * of the pcap file "filename" if it has a valid one (since 1.2; flow ids
+ * are numbered within the file)
+ */
+PA_API pa_trace* pa_trace_open(const char* filename);
+
+/**
+ * @brief Unmaps "trace"; its columns become invalid
+ */
+PA_API void pa_trace_close(pa_trace* trace);
+
+/**
+ * @brief Returns the number of records of "trace"
+ */
+PA_API size_t pa_trace_size(const pa_trace* trace);
+
+/**
+ * @brief Returns the flow ids of "trace", one per record
+ */
+PA_API const uint32_t* pa_trace_flows(const pa_trace* trace);
+
+/**
+ * @brief Returns the timestamps (usec) of "trace", or NULL if it has none
+ */
+PA_API const int64_t* pa_trace_times(const pa_trace* trace);
+
+/* Analysis: results are series of rows with double columns */
+
+/**
+ * @brief Sliding window locality of "count" flow ids; see the
+ * "mode-locality-analyze" mode of tool-pcap-analyzer. Column 0 is the reuse
+ * factor of every step; with "hll_precision" > 0, column 1 is the estimated
+ * number of distinct flows.
+ * @param times Timestamps (usec), required if "by_time", or NULL
+ * @param threads Number of threads (0: size of the shared pool)
+ */
+PA_API pa_series* pa_locality_analyze(const uint32_t* flows,
+                                      const int64_t* times, size_t count,
+                                      int by_time, long window, long step,
+                                      int hll_precision, int threads);
+
+/**
+ * @brief LRU miss ratio curve of "count" flow ids, with SHARDS sampling at
+ * "rate" keeping up to "max_tracked" flows (0: unbounded). Column 0 is the
+ * cache size, column 1 the miss ratio.
+ */
+PA_API pa_series* pa_miss_ratio_curve(const uint32_t* refs, size_t count,
+                                      double rate, size_t max_tracked);
+
+/**
+ * @brief Simulates a cache of "capacity" entries with "policy" (lru, lfu,
+ * arc, s3fifo, emc) over "count" flow ids, and sets "hits"
+ * @param ways Associativity of the "emc" policy
+ */
+PA_API int pa_cache_hits(const char* policy, size_t capacity, size_t ways,
+                         const uint32_t* refs, size_t count, uint64_t* hits);
+
+/**
+ * @brief Frees "series" and its columns
+ */
+PA_API void pa_series_free(pa_series* series);
+
+/**
+ * @brief Returns the number of rows of "series"
+ */
+PA_API size_t pa_series_rows(const pa_series* series);
+
+/**
+ * @brief Returns the number of columns of "series"
+ */
+PA_API size_t pa_series_columns(const pa_series* series);
+
+/**
+ * @brief Returns column "column" of "series", or NULL
+ */
+PA_API const double* pa_series_column(const pa_series* series,
+                                      size_t column);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
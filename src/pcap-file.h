@@ -0,0 +1,269 @@
+#ifndef PCAP_FILE_H
+#define PCAP_FILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pcap/pcap.h>
+
+#include <fstream>
+#include <memory>
+
+#include "errorf.h"
+#include "mapped-file.h"
+#include "read-ahead.h"
+
+/* Classic pcap magic numbers (microsecond and nanosecond resolution) */
+const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+
+struct pcap_file_header_raw {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header_raw {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+/**
+ * @brief Byte order, timestamp resolution and link layer of a classic pcap
+ * file, taken from its file header
+ */
+class PcapFormat {
+
+    bool swapped;
+    bool nsec;
+    uint32_t linktype;
+
+    uint32_t host(uint32_t value) const {
+        return swapped ? __builtin_bswap32(value) : value;
+    }
+
+public:
+
+    PcapFormat()
+    : swapped(false), nsec(false), linktype(0)
+    {}
+
+    /**
+     * @brief Returns true if "magic" starts a classic pcap file (any byte
+     * order and resolution); pcapng and others do not
+     */
+    static bool is_classic_magic(uint32_t magic) {
+        return magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+               magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+               magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    }
+
+    /**
+     * @brief Reads the file header of "filename"
+     */
+    void parse_header(const pcap_file_header_raw* hdr, const char* filename) {
+        swapped = hdr->magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+                  hdr->magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+        uint32_t magic = host(hdr->magic);
+        if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+            throw errorf("File \"%s\" is not a classic pcap file", filename);
+        }
+        nsec = magic == PCAP_MAGIC_NSEC;
+        /* The upper bits may hold the FCS length */
+        linktype = host(hdr->linktype) & 0x0fffffff;
+    }
+
+    /**
+     * @brief Returns the captured length of a record
+     */
+    uint32_t caplen(const pcap_record_header_raw* rec) const {
+        return host(rec->caplen);
+    }
+
+    /**
+     * @brief Converts a record header to a libpcap style header (timestamp
+     * in usec)
+     */
+    void decode(const pcap_record_header_raw* rec, struct pcap_pkthdr& h) const {
+        h.ts.tv_sec = host(rec->ts_sec);
+        h.ts.tv_usec = nsec ? host(rec->ts_frac) / 1000 : host(rec->ts_frac);
+        h.caplen = host(rec->caplen);
+        h.len = host(rec->len);
+    }
+
+    uint32_t get_linktype() const {
+        return linktype;
+    }
+};
+
+/**
+ * @brief Memory mapped reader of classic pcap files. Records are returned
+ * in place (no copies); the caller gets a libpcap style header.
+ */
+class PcapFile {
+
+    MappedFile file;
+    PcapFormat format;
+    size_t offset;
+
+public:
+
+    /**
+     * @brief Returns true if "filename" is a classic pcap file (any byte
+     * order and resolution); pcapng and others are not
+     */
+    static bool is_classic(const char* filename) {
+        uint32_t magic;
+        std::ifstream is(filename, std::ios_base::binary);
+        if (!is.read((char*)&magic, sizeof(magic))) {
+            return false;
+        }
+        return PcapFormat::is_classic_magic(magic);
+    }
+
+    PcapFile(const char* filename)
+    : file(filename), offset(sizeof(pcap_file_header_raw))
+    {
+        if (file.size() < sizeof(pcap_file_header_raw)) {
+            throw errorf("File \"%s\" is not a pcap file", filename);
+        }
+        format.parse_header((const pcap_file_header_raw*)file.data(),
+                            filename);
+    }
+
+    /**
+     * @brief Returns the link-layer type (LINKTYPE_* value)
+     */
+    uint32_t get_linktype() const {
+        return format.get_linktype();
+    }
+
+    /**
+     * @brief Returns the next record; false at the end of the file (a
+     * truncated last record is ignored)
+     * @param h Set to the record header (timestamp in usec)
+     * @param data Set to the captured bytes, inside the mapping
+     */
+    bool next(struct pcap_pkthdr& h, const u_char*& data) {
+        if (offset + sizeof(pcap_record_header_raw) > file.size()) {
+            return false;
+        }
+        const pcap_record_header_raw* rec =
+                (const pcap_record_header_raw*)(file.data() + offset);
+        size_t end = offset + sizeof(pcap_record_header_raw) +
+                     format.caplen(rec);
+        if (end > file.size()) {
+            return false;
+        }
+        format.decode(rec, h);
+        data = (const u_char*)file.data() + offset +
+               sizeof(pcap_record_header_raw);
+        offset = end;
+        return true;
+    }
+
+    /**
+     * @brief Returns the file offset of the next record
+     */
+    size_t tell() const {
+        return offset;
+    }
+
+    /**
+     * @brief Continues reading from file offset "position", which must be
+     * the start of a record
+     */
+    void seek(size_t position) {
+        offset = position;
+    }
+
+    /**
+     * @brief Returns the file size
+     */
+    size_t size() const {
+        return file.size();
+    }
+};
+
+/**
+ * @brief Reader of classic pcap files through "ReadAhead" (O_DIRECT,
+ * asynchronous reads into a ring of buffers). Same interface as
+ * "PcapFile"; records are valid until the following "next".
+ */
+class PcapStream {
+
+    PcapFormat format;
+    std::unique_ptr<ReadAheadStream> stream;
+    const char* filename;
+    read_ahead_options options;
+    size_t last;
+
+public:
+
+    PcapStream(const char* filename, const read_ahead_options& options)
+    : filename(filename), options(options), last(0)
+    {
+        pcap_file_header_raw hdr;
+        std::ifstream is(filename, std::ios_base::binary);
+        if (!is.read((char*)&hdr, sizeof(hdr))) {
+            throw errorf("File \"%s\" is not a pcap file", filename);
+        }
+        format.parse_header(&hdr, filename);
+    }
+
+    /**
+     * @brief Continues reading from file offset "position", which must be
+     * the start of a record. Reading starts with the first "next" call,
+     * so a seek before it costs nothing.
+     */
+    void seek(size_t position) {
+        stream.reset(new ReadAheadStream(filename, options, position));
+        last = 0;
+    }
+
+    /**
+     * @brief Returns the file offset of the next record
+     */
+    size_t tell() {
+        if (!stream) {
+            seek(sizeof(pcap_file_header_raw));
+        }
+        return stream->tell() + last;
+    }
+
+    uint32_t get_linktype() const {
+        return format.get_linktype();
+    }
+
+    /**
+     * @brief Returns the next record; false at the end of the file (a
+     * truncated last record is ignored)
+     */
+    bool next(struct pcap_pkthdr& h, const u_char*& data) {
+        if (!stream) {
+            seek(sizeof(pcap_file_header_raw));
+        }
+        stream->consume(last);
+        last = 0;
+        if (stream->fill(sizeof(pcap_record_header_raw)) <
+                sizeof(pcap_record_header_raw)) {
+            return false;
+        }
+        size_t length = sizeof(pcap_record_header_raw) +
+                format.caplen((const pcap_record_header_raw*)stream->data());
+        if (stream->fill(length) < length) {
+            return false;
+        }
+        format.decode((const pcap_record_header_raw*)stream->data(), h);
+        data = (const u_char*)stream->data() + sizeof(pcap_record_header_raw);
+        last = length;
+        return true;
+    }
+};
+
+#endif
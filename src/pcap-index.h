@@ -0,0 +1,214 @@
+#ifndef PCAP_INDEX_H
+#define PCAP_INDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "errorf.h"
+#include "mapped-file.h"
+
+/*
+ * Sidecar index of a classic pcap file ("FILE.idx"): sparse checkpoints
+ * every "interval" records, each with the file offset and number of its
+ * record. Timestamps in a capture are not always ordered, so every
+ * checkpoint also keeps the largest timestamp of all records before it
+ * and the smallest timestamp of all records from it on; a time range is
+ * then located exactly, whatever the order. The header holds the size
+ * and modification time of the pcap file; a stale index is ignored.
+ */
+const char PCAP_INDEX_MAGIC[8] = {'P','C','A','P','I','N','D','X'};
+const uint32_t PCAP_INDEX_VERSION = 1;
+
+struct pcap_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval;
+    uint64_t pcap_size;
+    int64_t pcap_mtime;
+    uint64_t count;
+};
+
+struct pcap_index_entry {
+    uint64_t offset;
+    uint64_t packet;
+    int64_t max_before;
+    int64_t min_after;
+};
+
+/**
+ * @brief Returns the sidecar index filename of "pcap_filename"
+ */
+static inline std::string
+pcap_index_filename(const char* pcap_filename)
+{
+    return std::string(pcap_filename) + ".idx";
+}
+
+/**
+ * @brief Reads the size and modification time (nsec) of "filename"
+ */
+static inline bool
+pcap_file_identity(const char* filename, uint64_t& size, int64_t& mtime)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return false;
+    }
+    size = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+/**
+ * @brief Memory mapped sidecar index of a pcap file
+ */
+class PcapIndex {
+
+    MappedFile file;
+    const pcap_index_header* hdr;
+    const pcap_index_entry* entries;
+
+public:
+
+    /**
+     * @brief Returns true if "pcap_filename" has an index that matches
+     * its current size and modification time
+     */
+    static bool is_valid(const char* pcap_filename) {
+        std::string name = pcap_index_filename(pcap_filename);
+        pcap_index_header h;
+        FILE* f = fopen(name.c_str(), "rb");
+        if (!f) {
+            return false;
+        }
+        bool ok = fread(&h, sizeof(h), 1, f) == 1;
+        fclose(f);
+        uint64_t size;
+        int64_t mtime;
+        return ok && !memcmp(h.magic, PCAP_INDEX_MAGIC, sizeof(h.magic)) &&
+               h.version == PCAP_INDEX_VERSION &&
+               pcap_file_identity(pcap_filename, size, mtime) &&
+               h.pcap_size == size && h.pcap_mtime == mtime;
+    }
+
+    /**
+     * @brief Maps the index of "pcap_filename" (see "is_valid")
+     */
+    PcapIndex(const char* pcap_filename)
+    : file(pcap_index_filename(pcap_filename).c_str(), MADV_RANDOM),
+      hdr((const pcap_index_header*)file.data()),
+      entries((const pcap_index_entry*)(file.data() + sizeof(*hdr)))
+    {
+        if (file.size() < sizeof(*hdr) ||
+                file.size() < sizeof(*hdr) + hdr->count * sizeof(*entries)) {
+            throw errorf("Index of \"%s\" is truncated", pcap_filename);
+        }
+    }
+
+    size_t size() const {
+        return hdr->count;
+    }
+
+    /**
+     * @brief Returns the last checkpoint before which no record has a
+     * timestamp of "from" or later (reading can start there), or NULL if
+     * reading must start at the first record
+     */
+    const pcap_index_entry* seek(int64_t from) const {
+        /* "max_before" is non-decreasing */
+        const pcap_index_entry* end = entries + hdr->count;
+        const pcap_index_entry* it = std::lower_bound(
+                entries, end, from,
+                [](const pcap_index_entry& e, int64_t t) {
+                    return e.max_before < t;
+                });
+        return it == entries ? NULL : it - 1;
+    }
+
+    /**
+     * @brief Returns the offset of the first checkpoint from which no
+     * record has a timestamp before "to" (reading can stop there), or
+     * UINT64_MAX
+     */
+    uint64_t stop_offset(int64_t to) const {
+        /* "min_after" is non-decreasing */
+        const pcap_index_entry* end = entries + hdr->count;
+        const pcap_index_entry* it = std::lower_bound(
+                entries, end, to,
+                [](const pcap_index_entry& e, int64_t t) {
+                    return e.min_after < t;
+                });
+        return it == end ? UINT64_MAX : it->offset;
+    }
+};
+
+/**
+ * @brief Builds the index of a pcap file during a full pass over its
+ * records; costs a comparison per record and a checkpoint per "interval"
+ * records
+ */
+class PcapIndexBuilder {
+
+    uint32_t interval;
+    uint64_t packets;
+    int64_t max_seen;
+    std::vector<pcap_index_entry> entries;
+    std::vector<int64_t> segment_min;
+
+public:
+
+    PcapIndexBuilder(uint32_t interval = 4096)
+    : interval(interval), packets(0), max_seen(INT64_MIN)
+    {}
+
+    /**
+     * @brief Registers the next record, at file offset "offset"
+     */
+    void add(uint64_t offset, int64_t timestamp) {
+        if (packets % interval == 0) {
+            entries.push_back({offset, packets, max_seen, INT64_MAX});
+            segment_min.push_back(INT64_MAX);
+        }
+        max_seen = std::max(max_seen, timestamp);
+        segment_min.back() = std::min(segment_min.back(), timestamp);
+        packets++;
+    }
+
+    /**
+     * @brief Writes the index of "pcap_filename" next to it, atomically
+     */
+    void write(const char* pcap_filename) {
+        int64_t min_after = INT64_MAX;
+        for (size_t i=entries.size(); i-- > 0;) {
+            min_after = std::min(min_after, segment_min[i]);
+            entries[i].min_after = min_after;
+        }
+
+        pcap_index_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, PCAP_INDEX_MAGIC, sizeof(hdr.magic));
+        hdr.version = PCAP_INDEX_VERSION;
+        hdr.interval = interval;
+        hdr.count = entries.size();
+        if (!pcap_file_identity(pcap_filename, hdr.pcap_size,
+                                hdr.pcap_mtime)) {
+            throw errorf("Cannot stat file \"%s\"", pcap_filename);
+        }
+
+        write_file_atomic(pcap_index_filename(pcap_filename), "index",
+                          [&](FILE* f) {
+            return fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                   fwrite(entries.data(), sizeof(entries[0]),
+                          entries.size(), f) == entries.size();
+        });
+    }
+};
+
+#endif
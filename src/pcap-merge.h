@@ -0,0 +1,355 @@
+#ifndef PCAP_MERGE_H
+#define PCAP_MERGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pcap/pcap.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "errorf.h"
+#include "pcap-file.h"
+#include "link-layer.h"
+#include "packet-filter.h"
+#include "read-ahead.h"
+
+/**
+ * @brief Options of "PcapMerger"
+ * @param filter BPF expression evaluated by the prefetch threads if it is
+ * not native (see "PacketFilter"), or empty
+ * @param read_ahead Read classic pcap files through "ReadAhead", or NULL
+ * @param accept_time Packets for which this returns false (on the
+ * timestamp, in usec) are dropped by the prefetch threads, or empty
+ */
+struct pcap_merge_options {
+    std::string filter;
+    const read_ahead_options* read_ahead;
+    std::function<bool(int64_t)> accept_time;
+
+    pcap_merge_options()
+    : read_ahead(NULL)
+    {}
+};
+
+/**
+ * @brief Interleaves the packets of several capture files by timestamp,
+ * without an intermediate file. Each file is read by its own prefetch
+ * thread into a bounded queue of packet batches; the consumer merges the
+ * queue heads with a binary heap. Packets with equal timestamps come in
+ * file order. Every packet keeps the link type of its file.
+ */
+class PcapMerger {
+
+    static const size_t batch_packets = 4096;
+    static const size_t queue_batches = 4;
+
+    /* Packets copied out of the capture, with their headers */
+    struct batch {
+        std::vector<struct pcap_pkthdr> headers;
+        std::vector<size_t> offsets;
+        std::vector<u_char> data;
+
+        void clear() {
+            headers.clear();
+            offsets.clear();
+            data.clear();
+        }
+
+        void add(const struct pcap_pkthdr& h, const u_char* bytes) {
+            headers.push_back(h);
+            offsets.push_back(data.size());
+            data.insert(data.end(), bytes, bytes + h.caplen);
+        }
+    };
+
+    struct source {
+        std::string filename;
+        int linktype;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<batch>> full;
+        std::deque<std::unique_ptr<batch>> empty;
+        bool done;
+        std::string error;
+
+        /* Consumer side: the batch being merged and the next packet */
+        std::unique_ptr<batch> current;
+        size_t position;
+        int64_t timestamp;
+    };
+
+    pcap_merge_options options;
+    std::vector<std::unique_ptr<source>> sources;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop;
+
+    /* Min-heap of (timestamp, source) of the sources with packets */
+    std::vector<std::pair<int64_t, size_t>> heap;
+    size_t last;
+
+    static int64_t timestamp_of(const struct pcap_pkthdr& h) {
+        return (int64_t)h.ts.tv_sec * 1000000 + h.ts.tv_usec;
+    }
+
+    /**
+     * @brief Prefetch thread side: hands a full batch to the consumer and
+     * returns an empty one (waits if the queue is full). Returns NULL if
+     * the merger is stopping.
+     */
+    std::unique_ptr<batch> publish(source& s, std::unique_ptr<batch> b) {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.cv.wait(lock, [&]() { return stop || !s.empty.empty(); });
+        if (stop) {
+            return NULL;
+        }
+        s.full.push_back(std::move(b));
+        std::unique_ptr<batch> next = std::move(s.empty.front());
+        s.empty.pop_front();
+        s.cv.notify_all();
+        next->clear();
+        return next;
+    }
+
+    /**
+     * @brief Copies the accepted records of "file" ("PcapFile" or
+     * "PcapStream") into batches
+     */
+    template <typename F>
+    void prefetch_records(source& s, F& file) {
+        s.linktype = file.get_linktype();
+        std::unique_ptr<PacketFilter> filter;
+        if (!options.filter.empty()) {
+            filter.reset(new PacketFilter(options.filter));
+            if (filter->is_native()) {
+                filter.reset();
+            } else {
+                filter->compile(linktype_to_dlt(s.linktype));
+            }
+        }
+
+        std::unique_ptr<batch> b(new batch());
+        struct pcap_pkthdr h;
+        const u_char* bytes;
+        while (file.next(h, bytes)) {
+            if (options.accept_time && !options.accept_time(timestamp_of(h))) {
+                continue;
+            }
+            if (filter && !filter->match(&h, bytes)) {
+                continue;
+            }
+            b->add(h, bytes);
+            if (b->headers.size() == batch_packets) {
+                b = publish(s, std::move(b));
+                if (!b) {
+                    return;
+                }
+            }
+        }
+        if (!b->headers.empty()) {
+            publish(s, std::move(b));
+        }
+    }
+
+    /**
+     * @brief Reads a file that is not a classic pcap file with a supported
+     * link layer through libpcap, with the "ip or ip6" BPF filter
+     */
+    void prefetch_libpcap(source& s) {
+        char error[PCAP_ERRBUF_SIZE];
+        pcap_t* p = pcap_open_offline(s.filename.c_str(), error);
+        if (p == NULL) {
+            throw errorf("PCAP error: %s", error);
+        }
+        s.linktype = pcap_datalink(p);
+
+        std::string expression = "(ip or ip6)";
+        if (!options.filter.empty() &&
+                !PacketFilter(options.filter).is_native()) {
+            expression += " and (" + options.filter + ")";
+        }
+        struct bpf_program bpf;
+        if (PCAP_ERROR == pcap_compile(p, &bpf, expression.c_str(), 1, 0) ||
+                PCAP_ERROR == pcap_setfilter(p, &bpf)) {
+            std::string message = pcap_geterr(p);
+            pcap_close(p);
+            throw errorf("pcap filter error: %s", message.c_str());
+        }
+        pcap_freecode(&bpf);
+
+        std::unique_ptr<batch> b(new batch());
+        struct pcap_pkthdr* h;
+        const u_char* bytes;
+        while (pcap_next_ex(p, &h, &bytes) == 1) {
+            if (options.accept_time && !options.accept_time(timestamp_of(*h))) {
+                continue;
+            }
+            b->add(*h, bytes);
+            if (b->headers.size() == batch_packets) {
+                b = publish(s, std::move(b));
+                if (!b) {
+                    break;
+                }
+            }
+        }
+        if (b && !b->headers.empty()) {
+            publish(s, std::move(b));
+        }
+        pcap_close(p);
+    }
+
+    void prefetch(source& s) {
+        try {
+            const char* filename = s.filename.c_str();
+            bool native = false;
+            if (PcapFile::is_classic(filename) && options.read_ahead) {
+                PcapStream file(filename, *options.read_ahead);
+                if ((native = link_layer_supported(file.get_linktype()))) {
+                    prefetch_records(s, file);
+                }
+            } else if (PcapFile::is_classic(filename)) {
+                PcapFile file(filename);
+                if ((native = link_layer_supported(file.get_linktype()))) {
+                    prefetch_records(s, file);
+                }
+            }
+            if (!native) {
+                prefetch_libpcap(s);
+            }
+        } catch (std::exception& e) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.error = e.what();
+        }
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.done = true;
+        s.cv.notify_all();
+    }
+
+    /**
+     * @brief Consumer side: moves source "i" to its next packet; returns
+     * false at its end
+     */
+    bool advance(size_t i) {
+        source& s = *sources[i];
+        if (s.current && ++s.position < s.current->headers.size()) {
+            s.timestamp = timestamp_of(s.current->headers[s.position]);
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(s.mutex);
+        if (s.current) {
+            s.empty.push_back(std::move(s.current));
+            s.cv.notify_all();
+        }
+        s.cv.wait(lock, [&]() { return s.done || !s.full.empty(); });
+        if (s.full.empty()) {
+            if (!s.error.empty()) {
+                throw errorf("Error while reading \"%s\": %s",
+                             s.filename.c_str(), s.error.c_str());
+            }
+            return false;
+        }
+        s.current = std::move(s.full.front());
+        s.full.pop_front();
+        s.position = 0;
+        s.timestamp = timestamp_of(s.current->headers[0]);
+        return true;
+    }
+
+    static bool later(const std::pair<int64_t, size_t>& a,
+                      const std::pair<int64_t, size_t>& b) {
+        return a > b;
+    }
+
+    void push_source(size_t i) {
+        if (advance(i)) {
+            heap.emplace_back(sources[i]->timestamp, i);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+
+    void finish() {
+        for (auto& s : sources) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            stop = true;
+            s->cv.notify_all();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+public:
+
+    PcapMerger(const std::vector<std::string>& filenames,
+               const pcap_merge_options& options = pcap_merge_options())
+    : options(options), stop(false), last(SIZE_MAX)
+    {
+        for (auto& filename : filenames) {
+            std::unique_ptr<source> s(new source());
+            s->filename = filename;
+            s->linktype = 0;
+            s->done = false;
+            s->position = 0;
+            s->timestamp = 0;
+            for (size_t i=0; i<queue_batches; ++i) {
+                s->empty.emplace_back(new batch());
+            }
+            sources.push_back(std::move(s));
+        }
+        for (auto& s : sources) {
+            source* ptr = s.get();
+            threads.emplace_back([this, ptr]() { prefetch(*ptr); });
+        }
+        try {
+            for (size_t i=0; i<sources.size(); ++i) {
+                push_source(i);
+            }
+        } catch (...) {
+            finish();
+            throw;
+        }
+    }
+
+    ~PcapMerger() {
+        finish();
+    }
+
+    /**
+     * @brief Returns the next packet in timestamp order; false once all
+     * files are exhausted. The packet is valid until the following call.
+     * @param linktype Set to the link type of the packet's file
+     */
+    bool next(const struct pcap_pkthdr*& h, const u_char*& bytes,
+              int& linktype) {
+        /* The previous packet's source goes back with its next packet */
+        if (last != SIZE_MAX) {
+            push_source(last);
+            last = SIZE_MAX;
+        }
+        if (heap.empty()) {
+            return false;
+        }
+        std::pop_heap(heap.begin(), heap.end(), later);
+        size_t i = heap.back().second;
+        heap.pop_back();
+
+        source& s = *sources[i];
+        h = &s.current->headers[s.position];
+        bytes = s.current->data.data() + s.current->offsets[s.position];
+        linktype = s.linktype;
+        last = i;
+        return true;
+    }
+};
+
+#endif
@@ -13,7 +13,10 @@
 #include <pcap/pcap.h>
 
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <list>
 #include <utility>
@@ -24,6 +27,20 @@
 #include "log.h"
 #include "errorf.h"
 #include "net-checksums.h"
+#include "histogram.h"
+#include "trace-store.h"
+#include "flow-keys.h"
+#include "flow-table.h"
+#include "ipv4-decode.h"
+#include "ipv6-decode.h"
+#include "locality-stream.h"
+#include "pcap-file.h"
+#include "link-layer.h"
+#include "packet-filter.h"
+#include "pcap-index.h"
+#include "trace-cache.h"
+#include "packet-sampler.h"
+#include "pcap-merge.h"
 
 const int WORD_WIDTH = 4;
 
@@ -225,48 +242,167 @@ public:
 
 
 /**
- * @brief Reads PCAP files
+ * @brief Reads PCAP files. Classic pcap files with a supported link layer
+ * are mapped and parsed in place; other files are read with libpcap.
+ * @tparam Key The flow key type (see flow-keys.h); packets with the same
+ * key get the same flow id
  */
+template <typename Key = FiveTupleKey>
 class PcapReader {
 
+    TraceStore trace;
+    FlowTable<Key> flow_table;
+
+    /* Locality of additional flow keys, from the same decoded packets */
+    std::vector<std::unique_ptr<LocalityStream>> streams;
+
+    /* Optional user filter, and the link layer of the current file */
+    std::unique_ptr<PacketFilter> filter;
+    int linktype;
+
+    /* Set to read classic pcap files through "ReadAhead" instead of mmap */
+    std::unique_ptr<read_ahead_options> read_ahead;
+
+    /* Only packets in [time_from, time_to) (usec) are read; sidecar
+     * indexes locate the range, and are built if "build_index" is set */
+    int64_t time_from;
+    int64_t time_to;
+    bool build_index;
+
+    /* Parse-time sampling, applied before flow lookup */
+    PacketSampler sampler;
+
+    /* Streaming distributions, updated only if "histograms" is set */
+    bool histograms;
+    Histogram size_hist;
+    Histogram ipd_hist;
+    Histogram flow_iat_hist;
+    std::vector<long> flow_last_time;
+
+    /* Packets waiting to be decoded and to get their flow ids, a burst at
+     * a time: the first bytes of their IPv4 headers are copied, decoded
+     * together (see "decode_ipv4_batch"), and their flow ids resolved
+     * together (see "FlowTable::find_or_insert_burst"). IPv6 packets (with
+     * dual-stack keys only) are decoded as they come. */
+    static const size_t burst_size = FlowTable<Key>::burst_size;
+    u_char burst_headers[burst_size][IPV4_TUPLE_BYTES];
+    uint32_t burst_caplens[burst_size];
+    bool burst_ipv6[burst_size];
+    packet_fields burst_fields6[burst_size];
+    uint32_t burst_lengths[burst_size];
+    int64_t burst_times[burst_size];
+    size_t burst_count;
+
+    /* Parsed-trace caches (see trace-cache.h) are used, and written while
+     * reading, if "cache_max_bytes" is not zero */
+    uint64_t cache_max_bytes;
+    std::unique_ptr<TraceCacheBuilder<Key>> cache_builder;
+    bool last_cached;
+
     /**
-     * @brief 5-tuple packet header
+     * @brief Decodes the pending burst, assigns the flow ids of the
+     * packets that pass the filter and the sampler, and appends them to
+     * the trace, in order
      */
-    struct five_tuple_header {
-        int protocol;
-        struct in_addr ip_src;
-        struct in_addr ip_dst;
-        int port_src;
-        int port_dst;
-
-        // Required for std::map
-        bool operator<(const five_tuple_header& other) const {
-            return
-                (protocol < other.protocol) ||
-                (ip_src.s_addr < other.ip_src.s_addr) ||
-                (ip_dst.s_addr < other.ip_dst.s_addr) ||
-                (port_src < other.port_src) ||
-                (port_dst < other.port_dst);
+    void flush_burst() {
+        const u_char* packets[burst_size];
+        for (size_t k=0; k<burst_count; ++k) {
+            packets[k] = burst_headers[k];
+        }
+        ipv4_tuples tuples;
+        decode_ipv4_batch(packets, burst_caplens, burst_count, tuples);
+
+        packet_fields fields[burst_size];
+        Key keys[burst_size];
+        size_t kept = 0;
+        for (size_t k=0; k<burst_count; ++k) {
+            if (burst_ipv6[k]) {
+                fields[kept] = burst_fields6[k];
+            } else if (tuples.valid[k]) {
+                fields[kept] = tuples.fields(k);
+            } else {
+                continue;
+            }
+            if (filter && filter->is_native() && !filter->match(fields[kept])) {
+                continue;
+            }
+            keys[kept] = Key::extract(fields[kept]);
+            if (!sampler.keep_flow(keys[kept].hash()) ||
+                !sampler.keep_packet()) {
+                continue;
+            }
+            burst_lengths[kept] = burst_lengths[k];
+            burst_times[kept] = burst_times[k];
+            kept++;
         }
+        burst_count = 0;
+
+        uint32_t ids[burst_size];
+        bool is_new[burst_size];
+        flow_table.find_or_insert_burst(keys, kept, ids, is_new);
+
+        for (size_t k=0; k<kept; ++k) {
+            // In case the packet is new, keep its 5-tuple once per flow
+            if (is_new[k] && fields[k].version == 6) {
+                std::array<uint8_t, 32> addresses;
+                memcpy(addresses.data(), fields[k].ip6_src, 16);
+                memcpy(addresses.data() + 16, fields[k].ip6_dst, 16);
+                trace.add_flow(fields[k].tuple(), &addresses);
+            } else if (is_new[k]) {
+                trace.add_flow(fields[k].tuple());
+            }
+            for (auto& stream : streams) {
+                stream->push(fields[k]);
+            }
+
+            // Update columns
+            if (histograms) {
+                update_histograms(ids[k], burst_lengths[k], burst_times[k]);
+            }
+            trace.push(ids[k], burst_lengths[k], burst_times[k]);
+            if (cache_builder) {
+                cache_builder->add(ids[k], keys[k], fields[k],
+                                   burst_lengths[k], burst_times[k]);
+            }
+        }
+    }
 
-        std::string to_string() const {
-            std::stringstream ss;
-            std::string src_ip_str(inet_ntoa(ip_src));
-            std::string dst_ip_str(inet_ntoa(ip_dst));
-            ss << "proto:" << protocol << " "
-               << "ip-src:" << src_ip_str.c_str() << " "
-               << "ip-dst:" << dst_ip_str.c_str() << " "
-               << "port-src:" << ntohs(port_src) << " "
-               << "port-dst:" << ntohs(port_dst);
-            return ss.str();
+    /**
+     * @brief Queues a captured frame of the current link layer for
+     * decoding and flow id assignment; the trace is complete after
+     * "flush_burst"
+     */
+    void process(const struct pcap_pkthdr* h, const u_char* bytes) {
+
+        int version;
+        int offset = ip_offset(linktype, bytes, h->caplen, version);
+        if (offset < 0) {
+            return;
         }
-    };
 
-    std::vector<packet_header> pcap_packets;
-    std::vector<long> locality;
-    std::vector<long> pkt_size;
-    std::vector<long> pkt_times;
-    std::map<std::string, int> seen_headers;
+        if (version == 6) {
+            if (!Key::dual_stack ||
+                !decode_ipv6_fields(bytes + offset, h->caplen - offset,
+                                    burst_fields6[burst_count]))
+            {
+                return;
+            }
+            burst_caplens[burst_count] = 0;
+            burst_ipv6[burst_count] = true;
+        } else {
+            uint32_t caplen = std::min<uint32_t>(h->caplen - offset,
+                                                 IPV4_TUPLE_BYTES);
+            memcpy(burst_headers[burst_count], bytes + offset, caplen);
+            burst_caplens[burst_count] = caplen;
+            burst_ipv6[burst_count] = false;
+        }
+        burst_lengths[burst_count] = h->len;
+        burst_times[burst_count] = (int64_t)h->ts.tv_sec * 1000000 +
+                                   h->ts.tv_usec;
+        if (++burst_count == burst_size) {
+            flush_burst();
+        }
+    }
 
     /**
      * @brief libpcap callback for reading packet
@@ -277,73 +413,114 @@ class PcapReader {
     static void pcap_handler (u_char* user,
                               const struct pcap_pkthdr* h,
                               const u_char* bytes) {
-
-        // Get the output vector from context
-        PcapReader& instance = *(PcapReader*)(user);
-
-        // Note: since we used Ethernet protocol filter,
-        // "bytes" points directly on the IP header.
-        const struct ip* iphdr = (const struct ip*)(bytes);
-
-        // Build the 5-tuple header
-        five_tuple_header fthdr;
-        fthdr.protocol = iphdr->ip_p;
-        fthdr.ip_src = iphdr->ip_src;
-        fthdr.ip_dst = iphdr->ip_dst;
-
-        // What is the ip protocol? (we support TCP, UDP, ICMP)
-        // TCP
-        if (iphdr->ip_p == 6) {
-            const struct tcphdr* tcphdr = (const struct tcphdr*)(bytes + 20);
-            fthdr.port_src = tcphdr->th_sport;
-            fthdr.port_dst = tcphdr->th_dport;
-        }
-        // UDP
-        else if (iphdr->ip_p == 17) {
-            const struct udphdr* udphdr = (const struct udphdr*)(bytes + 20);
-            fthdr.port_src = udphdr->uh_sport;
-            fthdr.port_dst = udphdr->uh_dport;
-        }
-        // All other
-        else {
-            fthdr.port_src = 0;
-            fthdr.port_dst = 0;
+        PcapReader* reader = (PcapReader*)user;
+        if (reader->in_range((int64_t)h->ts.tv_sec * 1000000 +
+                             h->ts.tv_usec)) {
+            reader->process(h, bytes);
         }
+    }
 
-        std::string repr = fthdr.to_string();
-        auto it = instance.seen_headers.find(repr);
-        size_t value;
+    /**
+     * @brief Returns true if a packet at "timestamp" (usec) is in the
+     * time range and in a sampled time slice
+     */
+    bool in_range(int64_t timestamp) const {
+        return timestamp >= time_from && timestamp < time_to &&
+               sampler.keep_time(timestamp);
+    }
 
-        // For debug
-        // NM_MESSAGE("%s", repr);
+    /**
+     * @brief Processes up to "count" records (-1: all) of "file", a
+     * "PcapFile" or a "PcapStream" of "filename". With a time range and a
+     * valid index, reading starts and stops at the checkpoints around the
+     * range; with "build_index", a full pass writes the index.
+     */
+    template <typename F>
+    void read_records(F& file, const char* filename, int count) {
+        linktype = file.get_linktype();
 
-        // In case the packet is new
-        if (it == instance.seen_headers.end()) {
-            value = instance.seen_headers.size();
-            instance.seen_headers[repr] = value;
+        bool bpf = filter && !filter->is_native();
+        if (bpf) {
+            filter->compile(linktype_to_dlt(linktype));
         }
-        // In case the packet is not new
-        else {
-            value = it->second;
+
+        bool ranged = time_from != INT64_MIN || time_to != INT64_MAX;
+        bool indexed = PcapIndex::is_valid(filename);
+        uint64_t stop = UINT64_MAX;
+        std::unique_ptr<PcapIndexBuilder> builder;
+        if (ranged && indexed) {
+            PcapIndex index(filename);
+            const pcap_index_entry* checkpoint = index.seek(time_from);
+            if (checkpoint) {
+                file.seek(checkpoint->offset);
+            }
+            stop = index.stop_offset(time_to);
+        } else if (build_index && !indexed) {
+            builder.reset(new PcapIndexBuilder());
         }
 
-        // Update vectors
-        instance.locality.push_back(value);
-        instance.pkt_size.push_back(h->len);
-        instance.pkt_times.push_back(h->ts.tv_sec * 1e6 + h->ts.tv_usec);
+        struct pcap_pkthdr h;
+        const u_char* bytes;
+        bool eof = false;
+        while (count != 0) {
+            uint64_t offset = file.tell();
+            if (offset >= stop) {
+                break;
+            }
+            if (!file.next(h, bytes)) {
+                eof = true;
+                break;
+            }
+            int64_t timestamp = (int64_t)h.ts.tv_sec * 1000000 + h.ts.tv_usec;
+            if (builder) {
+                builder->add(offset, timestamp);
+            }
+            if (!in_range(timestamp)) {
+                continue;
+            }
+            if (bpf && !filter->match(&h, bytes)) {
+                continue;
+            }
+            process(&h, bytes);
+            if (count > 0) {
+                count--;
+            }
+        }
 
-        packet_header packet;
-        packet[0] = fthdr.protocol;
-        packet[1] = ntohl(fthdr.ip_src.s_addr);
-        packet[2] = ntohl(fthdr.ip_dst.s_addr);
-        packet[3] = ntohs(fthdr.port_src);
-        packet[4] = ntohs(fthdr.port_dst);
-        instance.pcap_packets.push_back(packet);
+        if (builder && eof) {
+            builder->write(filename);
+        }
     }
 
-public:
+    /**
+     * @brief Reads "filename" without libpcap: through mmap, or through
+     * "ReadAhead" if enabled. Returns false (without reading) if it is not
+     * a classic pcap file with a supported link layer.
+     */
+    bool read_native(const char* filename, int count) {
+        if (!PcapFile::is_classic(filename)) {
+            return false;
+        }
+        if (read_ahead) {
+            PcapStream file(filename, *read_ahead);
+            if (!link_layer_supported(file.get_linktype())) {
+                return false;
+            }
+            read_records(file, filename, count);
+        } else {
+            PcapFile file(filename);
+            if (!link_layer_supported(file.get_linktype())) {
+                return false;
+            }
+            read_records(file, filename, count);
+        }
+        return true;
+    }
 
-    void read(const char* filename, int count) {
+    /**
+     * @brief Reads "filename" with libpcap
+     */
+    void read_libpcap(const char* filename, int count) {
 
         char error[PCAP_ERRBUF_SIZE];
 
@@ -352,24 +529,34 @@ public:
         if (p == NULL) {
             throw errorf("PCAP error: %s", error);
         }
+        linktype = pcap_datalink(p);
 
-        // Compile IPV4 filter
-        struct bpf_program filter;
-        if (PCAP_ERROR == pcap_compile(p, &filter, "ip", 1, 0)) {
+        // Compile IP filter, with the user filter if evaluated by BPF
+        std::string expression = Key::dual_stack ? "(ip or ip6)" : "ip";
+        if (filter && !filter->is_native()) {
+            expression += " and (" + filter->get_expression() + ")";
+        }
+        struct bpf_program bpf;
+        if (PCAP_ERROR == pcap_compile(p, &bpf, expression.c_str(), 1, 0)) {
+            std::string message = pcap_geterr(p);
             pcap_close(p);
-            throw errorf("pcap_compile error: %s", pcap_geterr(p));
+            throw errorf("pcap_compile error: %s", message.c_str());
         }
 
         // Set the filter
-        if (PCAP_ERROR == pcap_setfilter(p, &filter)) {
+        if (PCAP_ERROR == pcap_setfilter(p, &bpf)) {
+            std::string message = pcap_geterr(p);
+            pcap_freecode(&bpf);
             pcap_close(p);
-            throw errorf("pcap_setfilter error: %s", pcap_geterr(p));
+            throw errorf("pcap_setfilter error: %s", message.c_str());
         }
+        pcap_freecode(&bpf);
 
         // Process "count" packets with PCAP
         if (PCAP_ERROR == pcap_dispatch(p, count, pcap_handler, (u_char*)this)) {
+            std::string message = pcap_geterr(p);
             pcap_close(p);
-            throw errorf("pcap_dispatch error: %s", pcap_geterr(p));
+            throw errorf("pcap_dispatch error: %s", message.c_str());
         }
 
         // Close PCAP file
@@ -377,26 +564,315 @@ public:
     }
 
     /**
-     * @brief Returns the locality of this
+     * @brief Returns a hash of the options that decide which packets are
+     * kept (filter, time range and sampling)
+     */
+    uint64_t cache_options() const {
+        std::string expression = filter ? filter->get_expression() : "";
+        uint64_t h = trace_cache_hash(expression.data(), expression.size(),
+                                      sampler.config_hash());
+        h = hash64(h ^ time_from);
+        return hash64(h ^ time_to);
+    }
+
+    /**
+     * @brief Appends the cached trace of "filename" (with identity "id"),
+     * as reading the file would: its flows get ids in order of first
+     * appearance, then its packets are pushed. Returns false, without
+     * reading, if it has no valid cache of this key and these options.
+     */
+    bool read_cache(const char* filename, const trace_cache_identity& id) {
+        if (!TraceCacheFile::is_valid(filename, id)) {
+            return false;
+        }
+        TraceCacheFile cache(filename);
+        const Key* keys = cache.keys<Key>();
+        if (!keys || cache.options() != cache_options()) {
+            return false;
+        }
+
+        const std::array<uint32_t, 5>* tuples = cache.tuples();
+        const std::array<uint8_t, 32>* addresses = cache.addresses6();
+        std::vector<uint32_t> ids(cache.flow_count());
+        for (size_t i=0; i<ids.size(); ++i) {
+            bool is_new;
+            ids[i] = flow_table.find_or_insert(keys[i], is_new);
+            /* IPv4 flows have zero IPv6 addresses */
+            if (is_new && addresses &&
+                addresses[i] != std::array<uint8_t, 32>()) {
+                trace.add_flow(tuples[i], &addresses[i]);
+            } else if (is_new) {
+                trace.add_flow(tuples[i]);
+            }
+        }
+
+        const uint32_t* flows = cache.flows();
+        const uint32_t* lengths = cache.lengths();
+        const int64_t* times = cache.times();
+        for (size_t i=0; i<cache.size(); ++i) {
+            if (flows[i] >= ids.size()) {
+                throw errorf("Cache of \"%s\" has an invalid flow id at %lu",
+                             filename, i);
+            }
+            uint32_t flow = ids[flows[i]];
+            if (histograms) {
+                update_histograms(flow, lengths[i], times[i]);
+            }
+            trace.push(flow, lengths[i], times[i]);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Records the size, the inter-packet delay and the flow
+     * inter-arrival time of a packet. Negative delays (out of order
+     * timestamps) are not recorded.
+     */
+    void update_histograms(size_t flow, long size, int64_t timestamp) {
+        const ChunkedColumn<int64_t>& times = trace.get_times();
+        size_hist.record(size);
+        if (!times.empty() && timestamp >= times.back()) {
+            ipd_hist.record(timestamp - times.back());
+        }
+        if (flow >= flow_last_time.size()) {
+            flow_last_time.resize(flow + 1, -1);
+        } else if (flow_last_time[flow] >= 0 &&
+                   timestamp >= flow_last_time[flow]) {
+            flow_iat_hist.record(timestamp - flow_last_time[flow]);
+        }
+        flow_last_time[flow] = timestamp;
+    }
+
+public:
+
+    PcapReader()
+    : linktype(0), time_from(INT64_MIN), time_to(INT64_MAX),
+      build_index(false), histograms(false), burst_count(0),
+      cache_max_bytes(0), last_cached(false)
+    {}
+
+    /**
+     * @brief Enables the packet size, inter-packet delay and per-flow
+     * inter-arrival time histograms. Call before reading.
+     */
+    void enable_histograms() {
+        histograms = true;
+    }
+
+    /**
+     * @brief Continues the flow ids of the dictionary "filename" (see
+     * flow-dict.h), which must be loaded before any packet is read.
+     * Returns the number of flows loaded.
+     */
+    size_t load_flow_dict(const char* filename) {
+        return ::load_flow_dict(filename, flow_table, &trace);
+    }
+
+    /**
+     * @brief Saves all flows seen so far (loaded and new) to the
+     * dictionary "filename", atomically
+     */
+    void save_flow_dict(const char* filename) const {
+        ::save_flow_dict(filename, flow_table, &trace);
+    }
+
+    /**
+     * @brief Also computes the locality of the flow key named "name" while
+     * reading. Call before reading.
+     */
+    void add_locality_stream(const std::string& name) {
+        std::unique_ptr<LocalityStream> stream = make_locality_stream(name);
+        if (Key::dual_stack && !stream->dual_stack()) {
+            throw errorf("Flow key \"%s\" is IPv4 only and cannot be read "
+                         "with the dual-stack key \"%s\"", name.c_str(),
+                         Key::name());
+        }
+        streams.push_back(std::move(stream));
+    }
+
+    /**
+     * @brief Returns the additional locality streams, in order of addition
+     */
+    const std::vector<std::unique_ptr<LocalityStream>>&
+    get_locality_streams() const {
+        return streams;
+    }
+
+    /**
+     * @brief Only keep packets that match "expression" (BPF syntax). Simple
+     * expressions are evaluated natively, see "PacketFilter".
+     */
+    void set_filter(const std::string& expression) {
+        filter.reset(new PacketFilter(expression));
+    }
+
+    /**
+     * @brief Reads classic pcap files with O_DIRECT asynchronous read-ahead
+     * (see "ReadAhead") instead of mmap
+     */
+    void set_read_ahead(const read_ahead_options& options) {
+        read_ahead.reset(new read_ahead_options(options));
+    }
+
+    /**
+     * @brief Only reads packets with timestamps in [from, to) (usec). With
+     * a valid sidecar index (see pcap-index.h), classic pcap files are only
+     * read around the range.
+     */
+    void set_time_range(int64_t from, int64_t to) {
+        time_from = from;
+        time_to = to;
+    }
+
+    /**
+     * @brief Returns the sampler, to enable sampling modes before reading
+     * (see "PacketSampler")
      */
-    const std::vector<long>& get_locality() const {
-        return locality;
+    PacketSampler& get_sampler() {
+        return sampler;
+    }
+
+    /**
+     * @brief Writes a sidecar index for every classic pcap file that is
+     * read in full and has no valid index
+     */
+    void enable_index() {
+        build_index = true;
+    }
+
+    /**
+     * @brief Loads every file read in full from its parsed-trace cache
+     * (see trace-cache.h) if it has a valid one for this key and these
+     * options, instead of parsing it; otherwise writes the cache while
+     * reading, unless it exceeds "max_bytes". Files are always parsed
+     * with additional locality streams or 1-in-N sampling.
+     */
+    void enable_cache(uint64_t max_bytes) {
+        cache_max_bytes = max_bytes;
+    }
+
+    /**
+     * @brief Returns true if the last "read" loaded a cache
+     */
+    bool cached() const {
+        return last_cached;
+    }
+
+    /**
+     * @brief Returns true if the filter is evaluated natively
+     */
+    bool native_filter() const {
+        return filter && filter->is_native();
+    }
+
+    /**
+     * @brief Reads up to "count" IP packets (-1: all) from "filename", or
+     * loads its cache (see "enable_cache")
+     */
+    void read(const char* filename, int count) {
+        cache_builder.reset();
+        trace_cache_identity id;
+        bool cacheable = cache_max_bytes && count < 0 && streams.empty() &&
+                         !sampler.stateful() &&
+                         trace_cache_identity_of(filename, id);
+        last_cached = cacheable && read_cache(filename, id);
+        if (last_cached) {
+            return;
+        }
+        if (cacheable) {
+            cache_builder.reset(new TraceCacheBuilder<Key>(id,
+                                                           cache_max_bytes));
+        }
+
+        if (!read_native(filename, count)) {
+            read_libpcap(filename, count);
+        }
+        flush_burst();
+
+        if (cache_builder) {
+            cache_builder->write(filename, cache_options());
+            cache_builder.reset();
+        }
+    }
+
+    /**
+     * @brief Reads up to "count" IP packets (-1: all) from all of
+     * "filenames" at once, interleaved by timestamp (see "PcapMerger").
+     * Sidecar indexes and caches are neither used nor built.
+     */
+    void read_merged(const std::vector<std::string>& filenames, int count) {
+        cache_builder.reset();
+        last_cached = false;
+        pcap_merge_options options;
+        if (filter) {
+            options.filter = filter->get_expression();
+        }
+        options.read_ahead = read_ahead.get();
+        options.accept_time = [this](int64_t timestamp) {
+            return in_range(timestamp);
+        };
+
+        PcapMerger merger(filenames, options);
+        const struct pcap_pkthdr* h;
+        const u_char* bytes;
+        while (count != 0 && merger.next(h, bytes, linktype)) {
+            process(h, bytes);
+            if (count > 0) {
+                count--;
+            }
+        }
+        flush_burst();
+    }
+
+    /**
+     * @brief Returns the locality (flow id per packet) of this
+     */
+    const ChunkedColumn<uint32_t>& get_locality() const {
+        return trace.get_flows();
     }
 
     /**
      * @brief Returns the sizes of packets in this
      * @return
      */
-    const std::vector<long>& get_sizes() const {
-        return pkt_size;
+    const ChunkedColumn<uint16_t>& get_sizes() const {
+        return trace.get_sizes();
     }
 
     /**
      * @brief Returns the timestampts of packets in this
      * @return
      */
-    const std::vector<long>& get_timestamps() const {
-        return pkt_times;
+    const ChunkedColumn<int64_t>& get_timestamps() const {
+        return trace.get_times();
+    }
+
+    /**
+     * @brief Returns the trace store (columns and the 5-tuple of each flow)
+     */
+    const TraceStore& get_trace() const {
+        return trace;
+    }
+
+    /**
+     * @brief Returns the histogram of packet sizes (bytes)
+     */
+    const Histogram& get_size_histogram() const {
+        return size_hist;
+    }
+
+    /**
+     * @brief Returns the histogram of inter-packet delays (usec)
+     */
+    const Histogram& get_ipd_histogram() const {
+        return ipd_hist;
+    }
+
+    /**
+     * @brief Returns the histogram of per-flow inter-arrival times (usec)
+     */
+    const Histogram& get_flow_iat_histogram() const {
+        return flow_iat_hist;
     }
 };
 #endif
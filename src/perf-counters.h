@@ -0,0 +1,86 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/**
+ * @brief A hardware event counter of this thread (perf_event_open). The
+ * counter is invalid if the kernel or the hardware does not expose the
+ * event (containers often do not); reads then return -1.
+ */
+class PerfCounter {
+
+    int fd;
+
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+public:
+
+    /**
+     * @param type PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, ...
+     * @param config The event within "type"
+     */
+    PerfCounter(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    /**
+     * @brief Returns the PERF_TYPE_HW_CACHE config of data TLB load misses
+     */
+    static uint64_t dtlb_load_misses() {
+        return PERF_COUNT_HW_CACHE_DTLB |
+               (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    bool valid() const {
+        return fd >= 0;
+    }
+
+    /**
+     * @brief Resets the count and starts counting
+     */
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    /**
+     * @brief Stops counting, returns the count
+     */
+    long stop() {
+        uint64_t value;
+        if (fd < 0) {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (::read(fd, &value, sizeof(value)) != sizeof(value)) {
+            return -1;
+        }
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,496 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "errorf.h"
+#include "arguments.h"
+
+/* O_DIRECT requires buffers, offsets and lengths aligned to the block size
+ * of the device; 4 KB covers all common devices */
+const size_t READ_AHEAD_ALIGNMENT = 4096;
+
+/**
+ * @brief Read-ahead configuration
+ * @param block_size Size of each buffer in the ring (rounded up to 4 KB)
+ * @param queue_depth Number of buffers, i.e. reads in flight
+ * @param direct Bypass the page cache with O_DIRECT. If the file system
+ * does not support it, the file is read through the page cache and the
+ * consumed pages are dropped.
+ */
+struct read_ahead_options {
+    size_t block_size;
+    int queue_depth;
+    bool direct;
+
+    read_ahead_options(size_t block_size = 8 << 20,
+                       int queue_depth = 4,
+                       bool direct = true)
+    : block_size(block_size), queue_depth(queue_depth), direct(direct)
+    {}
+};
+
+/**
+ * @brief Returns the read-ahead options given by the tool arguments
+ * "read-ahead", "read-ahead-block" (KB), "read-ahead-depth" and
+ * "read-ahead-buffered", or NULL if "read-ahead" is not set
+ */
+static inline std::unique_ptr<read_ahead_options>
+get_read_ahead_options(struct arguments* args)
+{
+    if (!ARG_BOOL(args, "read-ahead", 0)) {
+        return NULL;
+    }
+    return std::unique_ptr<read_ahead_options>(new read_ahead_options(
+            (size_t)ARG_INTEGER(args, "read-ahead-block", 8192) << 10,
+            ARG_INTEGER(args, "read-ahead-depth", 4),
+            !ARG_BOOL(args, "read-ahead-buffered", 0)));
+}
+
+/**
+ * @brief Reads a file sequentially in large blocks, with up to
+ * "queue_depth" reads in flight ahead of the consumer. Reads go through
+ * io_uring when built with liburing (HAVE_LIBURING), otherwise through a
+ * pool of threads calling pread. Blocks are returned in file order.
+ */
+class ReadAhead {
+
+    struct slot {
+        char* buffer;
+        size_t offset;
+        ssize_t result;
+        bool done;
+    };
+
+    std::string filename;
+    int fd;
+    std::atomic<bool> direct;
+    size_t file_size;
+    size_t first_offset;
+    size_t block_size;
+    size_t num_blocks;
+    std::vector<slot> slots;
+
+    /* Block returned by the last "next", and next block to submit */
+    size_t current;
+    size_t submitted;
+
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    size_t in_flight;
+#else
+    std::vector<std::thread> workers;
+    std::deque<slot*> pending;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    bool stop;
+#endif
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    slot& slot_of(size_t block) {
+        return slots[block % slots.size()];
+    }
+
+    /**
+     * @brief Fills "s", returns the number of bytes read or -errno. Falls
+     * back to buffered reads if the file system rejects O_DIRECT.
+     */
+    ssize_t read_slot(slot& s) {
+        size_t length = std::min(block_size, file_size - s.offset);
+        /* O_DIRECT lengths must be aligned; the file ends before that */
+        size_t request = (length + READ_AHEAD_ALIGNMENT - 1) /
+                         READ_AHEAD_ALIGNMENT * READ_AHEAD_ALIGNMENT;
+        size_t total = 0;
+        while (total < length) {
+            ssize_t r = pread(fd, s.buffer + total, request - total,
+                              s.offset + total);
+            if (r < 0 && errno == EINVAL && direct) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                direct = false;
+                continue;
+            } else if (r < 0 && errno == EINTR) {
+                continue;
+            } else if (r < 0) {
+                return -errno;
+            } else if (r == 0) {
+                break;
+            }
+            total += r;
+        }
+        return std::min(total, length);
+    }
+
+#ifdef HAVE_LIBURING
+
+    void submit(size_t block) {
+        slot& s = slot_of(block);
+        s.offset = first_offset + block * block_size;
+        s.done = false;
+        size_t length = std::min(block_size, file_size - s.offset);
+        size_t request = (length + READ_AHEAD_ALIGNMENT - 1) /
+                         READ_AHEAD_ALIGNMENT * READ_AHEAD_ALIGNMENT;
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, fd, s.buffer, request, s.offset);
+        io_uring_sqe_set_data(sqe, &s);
+        io_uring_submit(&ring);
+        in_flight++;
+    }
+
+    /**
+     * @brief Waits for one completion. Short reads (other than at the end
+     * of the file) and O_DIRECT refusals are completed with pread.
+     */
+    void complete_one() {
+        struct io_uring_cqe* cqe;
+        int r = io_uring_wait_cqe(&ring, &cqe);
+        if (r < 0) {
+            throw errorf("io_uring error on \"%s\": %s",
+                         filename.c_str(), strerror(-r));
+        }
+        slot* s = (slot*)io_uring_cqe_get_data(cqe);
+        ssize_t res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        in_flight--;
+        size_t length = std::min(block_size, file_size - s->offset);
+        if (res == -EINVAL || (res >= 0 && (size_t)res < length)) {
+            res = read_slot(*s);
+        }
+        s->result = std::min<ssize_t>(res, length);
+        s->done = true;
+    }
+
+    void wait(slot& s) {
+        while (!s.done) {
+            complete_one();
+        }
+    }
+
+    void start() {
+        in_flight = 0;
+        int r = io_uring_queue_init(slots.size(), &ring, 0);
+        if (r < 0) {
+            throw errorf("Cannot create io_uring: %s", strerror(-r));
+        }
+    }
+
+    void finish() {
+        while (in_flight) {
+            complete_one();
+        }
+        io_uring_queue_exit(&ring);
+    }
+
+#else
+
+    void submit(size_t block) {
+        slot& s = slot_of(block);
+        s.offset = first_offset + block * block_size;
+        std::lock_guard<std::mutex> lock(mutex);
+        s.done = false;
+        pending.push_back(&s);
+        work_cv.notify_one();
+    }
+
+    void wait(slot& s) {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return s.done; });
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_cv.wait(lock, [&]() { return stop || !pending.empty(); });
+            if (stop) {
+                return;
+            }
+            slot* s = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            ssize_t result = read_slot(*s);
+            lock.lock();
+            s->result = result;
+            s->done = true;
+            done_cv.notify_all();
+        }
+    }
+
+    void start() {
+        stop = false;
+        for (size_t i=0; i<slots.size(); ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    void finish() {
+        /* Reads in progress complete before their worker sees "stop" */
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            pending.clear();
+        }
+        work_cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+#endif
+
+public:
+
+    /**
+     * @param offset Where to start reading; rounded down to the alignment
+     * (see "start_offset")
+     */
+    ReadAhead(const char* filename,
+              const read_ahead_options& options = read_ahead_options(),
+              size_t offset = 0)
+    : filename(filename), direct(options.direct), current(0), submitted(0)
+    {
+        int flags = O_RDONLY;
+        if (direct) {
+            flags |= O_DIRECT;
+        }
+        fd = ::open(filename, flags);
+        if (fd < 0 && direct) {
+            /* tmpfs and some others refuse O_DIRECT at open */
+            direct = false;
+            fd = ::open(filename, O_RDONLY);
+        }
+        if (fd < 0) {
+            throw errorf("Cannot read file \"%s\"", filename);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw errorf("Cannot stat file \"%s\"", filename);
+        }
+        file_size = st.st_size;
+        if (!direct) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        block_size = std::max<size_t>(options.block_size, 1);
+        block_size = (block_size + READ_AHEAD_ALIGNMENT - 1) /
+                     READ_AHEAD_ALIGNMENT * READ_AHEAD_ALIGNMENT;
+        first_offset = std::min(offset, file_size) / READ_AHEAD_ALIGNMENT *
+                       READ_AHEAD_ALIGNMENT;
+        num_blocks = (file_size - first_offset + block_size - 1) / block_size;
+
+        size_t depth = std::max(options.queue_depth, 1);
+        depth = std::max<size_t>(std::min(depth, num_blocks), 1);
+        slots.resize(depth);
+        for (auto& s : slots) {
+            if (posix_memalign((void**)&s.buffer, READ_AHEAD_ALIGNMENT,
+                               block_size) != 0) {
+                for (auto& o : slots) {
+                    if (&o == &s) {
+                        break;
+                    }
+                    free(o.buffer);
+                }
+                close(fd);
+                throw errorf("Cannot allocate read-ahead buffers");
+            }
+            s.done = false;
+        }
+
+        start();
+        for (; submitted < std::min(depth, num_blocks); ++submitted) {
+            submit(submitted);
+        }
+    }
+
+    ~ReadAhead() {
+        finish();
+        for (auto& s : slots) {
+            free(s.buffer);
+        }
+        close(fd);
+    }
+
+    /**
+     * @brief Returns the next block of the file and sets "length" to its
+     * size, or NULL at the end of the file. The block is valid until the
+     * following call, which recycles its buffer for a read further ahead.
+     */
+    const char* next(size_t& length) {
+        if (current > 0) {
+            size_t previous = current - 1;
+            if (!direct) {
+                posix_fadvise(fd, first_offset + previous * block_size, block_size,
+                              POSIX_FADV_DONTNEED);
+            }
+            if (submitted < num_blocks) {
+                submit(submitted++);
+            }
+        }
+        if (current == num_blocks) {
+            length = 0;
+            return NULL;
+        }
+        slot& s = slot_of(current++);
+        wait(s);
+        if (s.result < 0) {
+            throw errorf("Cannot read file \"%s\": %s",
+                         filename.c_str(), strerror(-s.result));
+        }
+        length = s.result;
+        return s.buffer;
+    }
+
+    /**
+     * @brief Returns the file offset of the first block
+     */
+    size_t start_offset() const {
+        return first_offset;
+    }
+
+    /**
+     * @brief Returns the file size
+     */
+    size_t size() const {
+        return file_size;
+    }
+};
+
+/**
+ * @brief Byte stream over "ReadAhead" blocks for parsers that need
+ * contiguous records: a record that spans two blocks is copied to a small
+ * carry buffer; all other records are parsed in place.
+ */
+class ReadAheadStream {
+
+    ReadAhead reader;
+    const char* block;
+    size_t block_length;
+    size_t position;
+    size_t offset;
+    std::vector<char> carry;
+    size_t carry_position;
+    bool in_carry;
+
+public:
+
+    /**
+     * @param start File offset of the first byte of the stream
+     */
+    ReadAheadStream(const char* filename,
+                    const read_ahead_options& options = read_ahead_options(),
+                    size_t start = 0)
+    : reader(filename, options, start), block(NULL), block_length(0),
+      position(0), offset(reader.start_offset()), carry_position(0),
+      in_carry(false)
+    {
+        size_t skip = std::min(start, reader.size()) - offset;
+        fill(skip);
+        consume(skip);
+    }
+
+    /**
+     * @brief Returns the unread bytes available contiguously at "data"
+     */
+    size_t available() const {
+        return in_carry ? carry.size() - carry_position
+                        : block_length - position;
+    }
+
+    const char* data() const {
+        return in_carry ? carry.data() + carry_position : block + position;
+    }
+
+    /**
+     * @brief Makes at least "n" bytes contiguous at "data" and returns the
+     * number available, which is less than "n" only at the end of the
+     * file. Invalidates pointers returned by "data".
+     */
+    size_t fill(size_t n) {
+        while (available() < n) {
+            if (!in_carry && position == block_length) {
+                block = reader.next(block_length);
+                position = 0;
+                if (!block) {
+                    break;
+                }
+                continue;
+            }
+            if (!in_carry) {
+                carry.assign(block + position, block + block_length);
+                carry_position = 0;
+                position = block_length;
+                in_carry = true;
+            } else if (carry_position > 0) {
+                carry.erase(carry.begin(), carry.begin() + carry_position);
+                carry_position = 0;
+            }
+            if (position == block_length) {
+                block = reader.next(block_length);
+                position = 0;
+                if (!block) {
+                    block_length = 0;
+                    break;
+                }
+            }
+            size_t take = std::min(n - available(), block_length - position);
+            carry.insert(carry.end(), block + position,
+                         block + position + take);
+            position += take;
+        }
+        return available();
+    }
+
+    /**
+     * @brief Skips "n" bytes, which must be available
+     */
+    void consume(size_t n) {
+        offset += n;
+        if (!in_carry) {
+            position += n;
+            return;
+        }
+        carry_position += n;
+        if (carry_position == carry.size()) {
+            carry.clear();
+            carry_position = 0;
+            in_carry = false;
+        }
+    }
+
+    /**
+     * @brief Returns the file offset of "data"
+     */
+    size_t tell() const {
+        return offset;
+    }
+
+    /**
+     * @brief Returns the file size
+     */
+    size_t size() const {
+        return reader.size();
+    }
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "thread-pool.h"
+
+ThreadPool::identity&
+ThreadPool::self()
+{
+    static thread_local identity id = {NULL, 0};
+    return id;
+}
+
+ThreadPool::shared_options&
+ThreadPool::get_shared_options()
+{
+    static shared_options options = {0, pin_mode::NONE, false};
+    return options;
+}
+
+ThreadPool&
+ThreadPool::shared()
+{
+    static ThreadPool pool(get_shared_options().threads,
+                           get_shared_options().pin);
+    get_shared_options().created = true;
+    return pool;
+}
@@ -0,0 +1,541 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "errorf.h"
+
+/**
+ * @brief Placement of the workers of a "ThreadPool"
+ */
+enum class pin_mode {
+    NONE,   /* Left to the scheduler */
+    CPU,    /* Worker i on the i-th allowed CPU (round robin) */
+    NUMA    /* Worker i on all CPUs of NUMA node i (round robin) */
+};
+
+/**
+ * @brief Parses "none", "cpu" or "numa"
+ */
+static inline pin_mode
+parse_pin_mode(const std::string& name)
+{
+    if (name == "none") {
+        return pin_mode::NONE;
+    } else if (name == "cpu") {
+        return pin_mode::CPU;
+    } else if (name == "numa") {
+        return pin_mode::NUMA;
+    }
+    throw errorf("Unknown pinning \"%s\" (supported: none, cpu, numa)",
+                 name.c_str());
+}
+
+/**
+ * @brief Parses a sysfs CPU list such as "0-3,8,10-11"
+ */
+static inline std::vector<int>
+parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu=first; cpu<=last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Returns the CPU sets of the NUMA nodes (empty if unknown)
+ */
+static inline std::vector<std::vector<int>>
+numa_node_cpus()
+{
+    std::vector<std::vector<int>> nodes;
+    for (int node=0; ; ++node) {
+        std::ifstream is("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!std::getline(is, list)) {
+            break;
+        }
+        std::vector<int> cpus = parse_cpu_list(list);
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+    return nodes;
+}
+
+/**
+ * @brief Work-stealing task scheduler. Every worker owns a deque: it runs
+ * its own tasks newest first (LIFO, cache-warm), and when it runs out it
+ * steals the oldest task of another worker (FIFO, the largest remaining
+ * piece of work). Tasks submitted by a worker go to its own deque, tasks
+ * from other threads are spread round robin. Deques are guarded by a
+ * mutex each, so there is no contention unless a deque is being robbed.
+ *
+ * A worker that waits for tasks (see "TaskGroup") runs queued tasks
+ * meanwhile, so tasks may wait for nested tasks without deadlock.
+ *
+ * One pool per process, "ThreadPool::shared()", is used by all parallel
+ * modes; "configure_shared" sets its size and pinning before first use.
+ */
+class ThreadPool {
+
+public:
+
+    typedef std::function<void()> task;
+
+private:
+
+    struct worker {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    /* The pool and worker index of the calling thread, if a worker */
+    struct identity {
+        ThreadPool* pool;
+        size_t index;
+    };
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> next_queue;
+    std::atomic<size_t> stolen;
+    bool stopping;
+
+    /* Defined in thread-pool.cpp and exported, like the shared pool, so
+     * that a worker started by libpcap-analyzer.so is known as such to the
+     * tools */
+    __attribute__((visibility("default")))
+    static identity& self();
+
+    bool pop(size_t i, task& t) {
+        worker& w = *workers[i];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.tasks.empty()) {
+            return false;
+        }
+        t = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        pending--;
+        return true;
+    }
+
+    bool steal(size_t i, task& t) {
+        worker& w = *workers[i];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.tasks.empty()) {
+            return false;
+        }
+        t = std::move(w.tasks.front());
+        w.tasks.pop_front();
+        pending--;
+        stolen++;
+        return true;
+    }
+
+    /**
+     * @brief Takes a task, from the deque of worker "home" first if it is
+     * a worker of this, then from the others
+     */
+    bool take(task& t) {
+        size_t n = workers.size();
+        identity& id = self();
+        size_t home = id.pool == this ? id.index : next_queue % n;
+        if (id.pool == this && pop(home, t)) {
+            return true;
+        }
+        for (size_t k=(id.pool == this); k<n; ++k) {
+            if (steal((home + k) % n, t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_worker(size_t index) {
+        self() = identity{this, index};
+        task t;
+        while (true) {
+            if (pending && take(t)) {
+                t();
+                t = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle_cv.wait(lock, [&]() { return stopping || pending > 0; });
+            if (stopping && pending == 0) {
+                return;
+            }
+        }
+    }
+
+    void pin(size_t index, pin_mode mode,
+             const std::vector<std::vector<int>>& sets) {
+        if (mode == pin_mode::NONE || sets.empty()) {
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : sets[index % sets.size()]) {
+            CPU_SET(cpu, &set);
+        }
+        /* Pinning is best effort, e.g. in a restricted cpuset */
+        pthread_setaffinity_np(threads[index].native_handle(), sizeof(set),
+                               &set);
+    }
+
+    struct shared_options {
+        size_t threads;
+        pin_mode pin;
+        bool created;
+    };
+
+    /* Defined in thread-pool.cpp and exported, so that the tools and
+     * libpcap-analyzer.so share one pool and its options */
+    __attribute__((visibility("default")))
+    static shared_options& get_shared_options();
+
+public:
+
+    /**
+     * @brief Starts "num_threads" workers (0: number of cores)
+     */
+    ThreadPool(size_t num_threads = 0, pin_mode mode = pin_mode::NONE)
+    : pending(0), next_queue(0), stolen(0), stopping(false)
+    {
+        if (num_threads == 0) {
+            num_threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+
+        std::vector<std::vector<int>> sets;
+        if (mode == pin_mode::NUMA) {
+            sets = numa_node_cpus();
+        }
+        if (mode == pin_mode::CPU || (mode == pin_mode::NUMA && sets.empty())) {
+            cpu_set_t allowed;
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+                for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &allowed)) {
+                        sets.push_back({cpu});
+                    }
+                }
+            }
+        }
+
+        for (size_t i=0; i<num_threads; ++i) {
+            workers.emplace_back(new worker());
+        }
+        for (size_t i=0; i<num_threads; ++i) {
+            threads.emplace_back([this, i]() { run_worker(i); });
+            pin(i, mode, sets);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            stopping = true;
+        }
+        idle_cv.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Returns the number of workers
+     */
+    size_t size() const {
+        return workers.size();
+    }
+
+    /**
+     * @brief Returns the number of tasks taken from another worker's deque
+     */
+    size_t steals() const {
+        return stolen;
+    }
+
+    /**
+     * @brief Queues "t"; see "TaskGroup" to wait for tasks
+     */
+    void submit(task t) {
+        identity& id = self();
+        size_t i = id.pool == this ? id.index :
+                   next_queue++ % workers.size();
+        {
+            std::lock_guard<std::mutex> lock(workers[i]->mutex);
+            workers[i]->tasks.push_back(std::move(t));
+            pending++;
+        }
+        /* Taking the lock orders the wake up after the waiters' check */
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+        }
+        idle_cv.notify_one();
+    }
+
+    /**
+     * @brief Returns true if the calling thread is a worker of this
+     */
+    bool in_worker() const {
+        return self().pool == this;
+    }
+
+    /**
+     * @brief Runs one queued task on the calling thread; returns false if
+     * there was none
+     */
+    bool run_one() {
+        task t;
+        if (!pending || !take(t)) {
+            return false;
+        }
+        t();
+        return true;
+    }
+
+    /**
+     * @brief Sets the size and pinning of the shared pool; must be called
+     * before its first use
+     */
+    static void configure_shared(size_t num_threads, pin_mode mode) {
+        shared_options& options = get_shared_options();
+        if (options.created) {
+            throw errorf("The shared thread pool is already running");
+        }
+        options.threads = num_threads;
+        options.pin = mode;
+    }
+
+    /**
+     * @brief Returns the pool shared by all parallel modes
+     */
+    __attribute__((visibility("default")))
+    static ThreadPool& shared();
+};
+
+/**
+ * @brief A set of tasks that can be waited for. The first exception
+ * thrown by a task is rethrown by "wait".
+ */
+class TaskGroup {
+
+    ThreadPool& pool;
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--remaining == 0) {
+            done.notify_all();
+        }
+    }
+
+public:
+
+    TaskGroup(ThreadPool& pool = ThreadPool::shared())
+    : pool(pool), remaining(0)
+    {}
+
+    ~TaskGroup() {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    /**
+     * @brief Runs "func" on the pool
+     */
+    template <typename F>
+    void run(F func) {
+        remaining++;
+        pool.submit([this, func]() {
+            try {
+                func();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            finish();
+        });
+    }
+
+    /**
+     * @brief Waits until "pred" holds. A worker of the pool runs queued
+     * tasks meanwhile; other threads just wait, so that the pool size
+     * bounds the number of busy threads.
+     */
+    template <typename P>
+    void help_until(P pred) {
+        bool helping = pool.in_worker();
+        while (!pred()) {
+            if (helping && pool.run_one()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if (helping) {
+                /* Tasks queued meanwhile are picked up at the next check */
+                done.wait_for(lock, std::chrono::microseconds(200), pred);
+            } else {
+                done.wait(lock, pred);
+            }
+        }
+    }
+
+    /**
+     * @brief Waits for all tasks (see "help_until")
+     */
+    void wait() {
+        help_until([this]() { return remaining == 0; });
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    /**
+     * @brief Notifies "wait" and "help_until" (for conditions set by
+     * tasks other than their completion)
+     */
+    void notify() {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+    }
+
+    bool failed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (bool)error;
+    }
+};
+
+/**
+ * @brief Calls "func(first, last)" on the pool for consecutive ranges of
+ * "grain" indexes (0: about four ranges per worker) covering [begin, end),
+ * and waits for all of them
+ */
+template <typename F>
+void
+parallel_for(size_t begin, size_t end, size_t grain, F func,
+             ThreadPool& pool = ThreadPool::shared())
+{
+    if (begin >= end) {
+        return;
+    }
+    if (grain == 0) {
+        grain = std::max<size_t>(1, (end - begin) / (4 * pool.size()));
+    }
+    TaskGroup group(pool);
+    for (size_t first=begin; first<end; first+=grain) {
+        size_t last = std::min(end, first + grain);
+        group.run([&func, first, last]() { func(first, last); });
+    }
+    group.wait();
+}
+
+/**
+ * @brief Computes "produce(i)" for i in [0, count) on the pool and calls
+ * "consume(i, result)" on the calling thread in index order, as soon as
+ * each result and all before it are ready, e.g. to stitch the outputs of
+ * parallel segments into a stream. At most "window" results (0: twice the
+ * pool size) are computed ahead of the consumer.
+ */
+template <typename T, typename P, typename C>
+void
+ordered_for(size_t count, P produce, C consume, size_t window = 0,
+            ThreadPool& pool = ThreadPool::shared())
+{
+    if (window == 0) {
+        window = 2 * pool.size();
+    }
+    std::vector<std::unique_ptr<T>> results(count);
+    std::unique_ptr<std::atomic<bool>[]> ready(new std::atomic<bool>[count]);
+    for (size_t i=0; i<count; ++i) {
+        ready[i] = false;
+    }
+
+    TaskGroup group(pool);
+    auto start = [&](size_t i) {
+        group.run([&, i]() {
+            try {
+                results[i].reset(new T(produce(i)));
+            } catch (...) {
+                ready[i] = true;
+                group.notify();
+                throw;
+            }
+            ready[i] = true;
+            group.notify();
+        });
+    };
+
+    size_t started = std::min(count, window);
+    for (size_t i=0; i<started; ++i) {
+        start(i);
+    }
+    for (size_t i=0; i<count; ++i) {
+        group.help_until([&]() { return (bool)ready[i]; });
+        if (!results[i]) {
+            break;
+        }
+        consume(i, *results[i]);
+        results[i].reset();
+        if (started < count) {
+            start(started++);
+        }
+    }
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,501 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arguments.h"
+#include "log.h"
+#include "errorf.h"
+#include "hash.h"
+#include "string-ops.h"
+#include "flow-keys.h"
+#include "flow-table.h"
+#include "ipv4-decode.h"
+#include "concurrent-flow-table.h"
+#include "page-allocator.h"
+#include "perf-counters.h"
+#include "thread-pool.h"
+
+static arguments args[] = {
+/* Name               R  B  Def        Help */
+// Mode flow table
+{"mode-flow-table",   0, 1, NULL,      "(Mode flow table) Inserts \"flows\" "
+                                       "distinct 5-tuples into a flow table, "
+                                       "then looks up \"lookups\" random "
+                                       "ones, once per page mode; prints the "
+                                       "time and data TLB misses of each "
+                                       "phase."},
+{"flows",             0, 0, "4000000", "(Mode flow table, concurrent flow "
+                                       "table) Distinct flows."},
+{"lookups",           0, 0, "20000000","(Mode flow table, flow lookup, "
+                                       "concurrent flow table) Random "
+                                       "lookups."},
+{"pages",             0, 0, "default;thp;hugetlb",
+                                       "(Mode flow table) Page modes to "
+                                       "compare, separated by semicolon."},
+// Mode flow lookup
+{"mode-flow-lookup",  0, 1, NULL,      "(Mode flow lookup) For every count "
+                                       "in \"flow-counts\", fills a flow "
+                                       "table, then looks up \"lookups\" "
+                                       "random 5-tuples one at a time and in "
+                                       "prefetched bursts; prints the "
+                                       "throughput of each."},
+{"flow-counts",       0, 0, "1000000;10000000;100000000",
+                                       "(Mode flow lookup) Flow counts, "
+                                       "separated by semicolon."},
+// Mode decode
+{"mode-decode",       0, 1, NULL,      "(Mode decode) Decodes \"packets\" "
+                                       "synthetic IPv4 headers (with and "
+                                       "without options; TCP, UDP and ICMP) "
+                                       "in batches with every decoder this "
+                                       "CPU supports; prints the throughput "
+                                       "of each and whether they agree."},
+{"packets",           0, 0, "1000000", "(Mode decode) Distinct headers, "
+                                       "decoded 50 times each."},
+// Mode thread pool
+{"mode-thread-pool",  0, 1, NULL,      "(Mode thread pool) Runs \"tasks\" "
+                                       "CPU-bound tasks with parallel_for on "
+                                       "pools of each size in \"threads\", "
+                                       "with uniform and skewed task costs "
+                                       "and with empty tasks; prints the "
+                                       "time, speedup and steals of each."},
+{"tasks",             0, 0, "4096",    "(Mode thread pool) Number of tasks."},
+{"task-work",         0, 0, "20000",   "(Mode thread pool) Hash iterations "
+                                       "per task (skewed: 16x for one task "
+                                       "in 16)."},
+{"threads",           0, 0, NULL,      "(Mode thread pool, concurrent flow "
+                                       "table) Thread counts, separated by "
+                                       "semicolon (default: powers of two "
+                                       "up to the number of cores; 1 to 64 "
+                                       "for the flow table)."},
+{"pin",               0, 0, "none",    "(Mode thread pool, concurrent flow "
+                                       "table) Worker pinning: "
+                                       "none, cpu or numa."},
+// Mode concurrent flow table
+{"mode-concurrent-flow-table",
+                      0, 1, NULL,      "(Mode concurrent flow table) Assigns "
+                                       "flow ids to \"lookups\" packets "
+                                       "drawn from \"flows\" 5-tuples "
+                                       "(uniform and Zipf), split among "
+                                       "\"threads\" threads; prints the "
+                                       "throughput, then the cost of the "
+                                       "deterministic renumbering and "
+                                       "whether it matches a sequential "
+                                       "pass."},
+{"zipf-alpha",        0, 0, "0.99",    "(Mode concurrent flow table) Zipf "
+                                       "skew."},
+{"shards",            0, 0, "64",      "(Mode concurrent flow table) Number "
+                                       "of shards."},
+{NULL,                0, 0, NULL,      "Micro-benchmarks of the analysis "
+                                       "data structures."}
+};
+
+/**
+ * @brief Returns a deterministic pseudo-random 5-tuple for index "i"
+ */
+static FiveTupleKey
+synthetic_key(uint64_t i)
+{
+    uint64_t h = hash64(i);
+    packet_fields fields;
+    fields.protocol = (h & 1) ? 6 : 17;
+    fields.ip_src = h >> 32;
+    fields.ip_dst = hash64(h) >> 32;
+    fields.port_src = h >> 8;
+    fields.port_dst = 1 + (i & 0x3ff);
+    return FiveTupleKey::extract(fields);
+}
+
+/**
+ * @brief Prints the elapsed milliseconds and TLB misses of "func"
+ */
+template <typename F>
+static void
+measure(const char* phase, F func)
+{
+    PerfCounter tlb(PERF_TYPE_HW_CACHE, PerfCounter::dtlb_load_misses());
+    auto start = std::chrono::steady_clock::now();
+    tlb.start();
+    func();
+    long misses = tlb.stop();
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start)
+                .count();
+    MESSAGE("  %-8s %10.1f ms  ", phase, ms);
+    if (misses >= 0) {
+        MESSAGE("%12ld dTLB misses\n", misses);
+    } else {
+        MESSAGE("%12s dTLB misses\n", "n/a");
+    }
+}
+
+static void
+mode_flow_table()
+{
+    size_t flows = ARG_INTEGER(args, "flows", 4000000);
+    size_t lookups = ARG_INTEGER(args, "lookups", 20000000);
+
+    StringOperations<std::string> str_ops;
+    std::vector<std::string> modes = str_ops.split(
+            ARG_STRING(args, "pages", ""), ";",
+            [](const std::string& s) { return s; });
+
+    for (auto& name : modes) {
+        set_page_mode(parse_page_mode(name));
+        size_t fallbacks = get_memory_stats().explicit_fallbacks;
+        FlowTable<FiveTupleKey> table;
+        bool is_new;
+        uint64_t checksum = 0;
+
+        MESSAGE("Pages: %s\n", name.c_str());
+        measure("insert", [&]() {
+            for (size_t i=0; i<flows; ++i) {
+                checksum += table.find_or_insert(synthetic_key(i), is_new);
+            }
+        });
+        measure("lookup", [&]() {
+            for (size_t i=0; i<lookups; ++i) {
+                uint64_t idx = hash64(i ^ 0x9e3779b97f4a7c15ULL) % flows;
+                checksum += table.find_or_insert(synthetic_key(idx), is_new);
+            }
+        });
+        long huge = anon_huge_pages_bytes();
+        MESSAGE("  table %lu MB, AnonHugePages %ld MB%s (checksum %lu)\n",
+                table.memory() >> 20, huge < 0 ? -1 : huge >> 20,
+                get_memory_stats().explicit_fallbacks > fallbacks ?
+                ", hugetlb unavailable: fell back to thp" : "",
+                checksum);
+    }
+}
+
+static void
+mode_flow_lookup()
+{
+    size_t lookups = ARG_INTEGER(args, "lookups", 20000000);
+    std::vector<long> counts = StringOperations<long>().split(
+            ARG_STRING(args, "flow-counts", "1000000;10000000;100000000"),
+            ";", [](const std::string& s) { return atol(s.c_str()); });
+
+    /* Lookup keys are built up front, and reused in a loop */
+    const size_t block = 1 << 20;
+    const size_t burst = FlowTable<FiveTupleKey>::burst_size;
+
+    MESSAGE("  %10s %10s %14s %14s %8s\n", "flows", "table MB",
+            "single Ml/s", "burst Ml/s", "speedup");
+    uint64_t checksum = 0;
+    for (long flows : counts) {
+        FlowTable<FiveTupleKey> table;
+        table.reserve(flows);
+        bool is_new;
+        for (long i=0; i<flows; ++i) {
+            table.find_or_insert(synthetic_key(i), is_new);
+        }
+
+        std::vector<FiveTupleKey> keys(std::min(block, lookups));
+        for (size_t i=0; i<keys.size(); ++i) {
+            keys[i] = synthetic_key(hash64(i ^ 0x9e3779b97f4a7c15ULL) % flows);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<lookups; ++i) {
+            checksum += table.find_or_insert(keys[i % keys.size()], is_new);
+        }
+        double single = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+        uint32_t ids[burst];
+        bool inserted[burst];
+        start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<lookups; ) {
+            size_t first = i % keys.size();
+            size_t n = std::min(std::min(burst, lookups - i),
+                                keys.size() - first);
+            table.find_or_insert_burst(&keys[first], n, ids, inserted);
+            for (size_t k=0; k<n; ++k) {
+                checksum += ids[k];
+            }
+            i += n;
+        }
+        double burst_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+        MESSAGE("  %10ld %10lu %14.1f %14.1f %8.2f\n", flows,
+                table.memory() >> 20, lookups / single / 1e3,
+                lookups / burst_ms / 1e3, single / burst_ms);
+    }
+    MESSAGE("(checksum %lu)\n", checksum);
+}
+
+static void
+mode_decode()
+{
+    size_t packets = ARG_INTEGER(args, "packets", 1000000);
+    const size_t batch = ipv4_tuples::capacity;
+    const int rounds = 50;
+    packets = (packets + batch - 1) / batch * batch;
+
+    /* Headers of IPV4_TUPLE_BYTES bytes, one in four with 4 bytes of
+     * options; caplens as captured with a 64-byte snaplen */
+    std::vector<u_char> data(packets * IPV4_TUPLE_BYTES);
+    std::vector<const u_char*> headers(packets);
+    std::vector<uint32_t> caplens(packets);
+    const uint8_t protocols[] = {IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP};
+    for (size_t i=0; i<packets; ++i) {
+        u_char* h = &data[i * IPV4_TUPLE_BYTES];
+        uint64_t r = hash64(i);
+        for (size_t j=0; j<IPV4_TUPLE_BYTES; ++j) {
+            h[j] = hash64(r + j);
+        }
+        h[0] = 0x40 | ((r & 3) == 0 ? 6 : 5);
+        h[9] = protocols[(r >> 2) % 3];
+        headers[i] = h;
+        caplens[i] = (r >> 8) % 8 == 0 ? 20 + (r >> 16) % 8 : 64 - 14;
+    }
+
+    struct decoder {
+        const char* name;
+        ipv4_batch_decoder func;
+    };
+    std::vector<decoder> decoders = {{"scalar", decode_ipv4_batch_scalar}};
+    const char* best;
+    ipv4_batch_decoder selected = select_ipv4_batch_decoder(&best);
+    if (selected != decode_ipv4_batch_scalar) {
+        decoders.push_back({best, selected});
+    }
+
+    MESSAGE("  %8s %10s %12s %8s\n", "decoder", "ms", "Mpkt/s", "agrees");
+    std::vector<ipv4_tuples> reference(packets / batch);
+    std::vector<ipv4_tuples> out(packets / batch);
+    uint64_t checksum = 0;
+    for (auto& d : decoders) {
+        auto start = std::chrono::steady_clock::now();
+        for (int r=0; r<rounds; ++r) {
+            for (size_t i=0; i<packets; i+=batch) {
+                d.func(&headers[i], &caplens[i], batch, out[i / batch]);
+                checksum += out[i / batch].port_dst[0];
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        if (d.func == decode_ipv4_batch_scalar) {
+            reference = out;
+        }
+        bool agrees = memcmp(reference.data(), out.data(),
+                             out.size() * sizeof(ipv4_tuples)) == 0;
+        MESSAGE("  %8s %10.1f %12.1f %8s\n", d.name, ms,
+                packets * rounds / ms / 1e3, agrees ? "yes" : "NO");
+    }
+    MESSAGE("(checksum %lu)\n", checksum);
+}
+
+/**
+ * @brief Returns the thread counts of the "threads" argument, or powers of
+ * two up to "max_threads"
+ */
+static std::vector<long>
+get_thread_counts(long max_threads)
+{
+    std::vector<long> counts;
+    const char* list = ARG_STRING(args, "threads", NULL);
+    if (list) {
+        counts = StringOperations<long>().split(list, ";",
+                [](const std::string& s) { return atol(s.c_str()); });
+    } else {
+        for (long t=1; t<=max_threads; t*=2) {
+            counts.push_back(t);
+        }
+    }
+    return counts;
+}
+
+/**
+ * @brief Busy work of "iterations" hash rounds
+ */
+static uint64_t
+spin(uint64_t seed, size_t iterations)
+{
+    for (size_t i=0; i<iterations; ++i) {
+        seed = hash64(seed);
+    }
+    return seed;
+}
+
+static void
+mode_thread_pool()
+{
+    size_t tasks = ARG_INTEGER(args, "tasks", 4096);
+    size_t work = ARG_INTEGER(args, "task-work", 20000);
+    pin_mode pin = parse_pin_mode(ARG_STRING(args, "pin", "none"));
+
+    std::vector<long> sizes = get_thread_counts(
+            std::thread::hardware_concurrency());
+
+    struct workload {
+        const char* name;
+        size_t work;
+        size_t skewed;
+    };
+    const workload workloads[] = {
+        {"uniform", work, 1},
+        {"skewed", work, 16},
+        {"empty", 0, 1}
+    };
+
+    std::vector<uint64_t> results(tasks);
+    uint64_t checksum = 0;
+    for (auto& w : workloads) {
+        MESSAGE("Workload: %s (%lu tasks)\n", w.name, tasks);
+        MESSAGE("  %8s %10s %8s %10s %10s\n", "threads", "ms", "speedup",
+                "efficiency", "steals");
+        double base = 0;
+        for (long t : sizes) {
+            ThreadPool pool(t, pin);
+            auto start = std::chrono::steady_clock::now();
+            parallel_for(0, tasks, 1, [&](size_t i, size_t) {
+                size_t cost = (i % 16 == 0) ? w.work * w.skewed : w.work;
+                results[i] = spin(i, cost);
+            }, pool);
+            double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            /* Relative to the first pool size */
+            if (base == 0) {
+                base = ms;
+            }
+            double speedup = base / ms;
+            MESSAGE("  %8ld %10.2f %8.2f %9.0f%% %10lu\n", t, ms, speedup,
+                    speedup * sizes[0] / t * 100, pool.steals());
+        }
+        for (auto r : results) {
+            checksum += r;
+        }
+    }
+    MESSAGE("(checksum %lu)\n", checksum);
+}
+
+/**
+ * @brief Returns "count" flow indexes in [0, flows): uniform, or Zipf with
+ * skew "alpha" (rank 0 most frequent) by inverse CDF
+ */
+static std::vector<uint32_t>
+synthetic_trace(size_t count, size_t flows, double alpha)
+{
+    std::vector<uint32_t> trace(count);
+    if (alpha <= 0) {
+        for (size_t i=0; i<count; ++i) {
+            trace[i] = hash64(i ^ 0x9e3779b97f4a7c15ULL) % flows;
+        }
+        return trace;
+    }
+    std::vector<double> cdf(flows);
+    double sum = 0;
+    for (size_t r=0; r<flows; ++r) {
+        sum += 1 / pow(r + 1, alpha);
+        cdf[r] = sum;
+    }
+    for (size_t i=0; i<count; ++i) {
+        double u = (hash64(i ^ 0x9e3779b97f4a7c15ULL) >> 11) * 0x1p-53 * sum;
+        trace[i] = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        trace[i] = std::min<size_t>(trace[i], flows - 1);
+    }
+    return trace;
+}
+
+static void
+mode_concurrent_flow_table()
+{
+    size_t flows = ARG_INTEGER(args, "flows", 4000000);
+    size_t lookups = ARG_INTEGER(args, "lookups", 20000000);
+    size_t shards = ARG_INTEGER(args, "shards", 64);
+    double alpha = ARG_DOUBLE(args, "zipf-alpha", 0.99);
+    pin_mode pin = parse_pin_mode(ARG_STRING(args, "pin", "none"));
+    std::vector<long> counts = get_thread_counts(64);
+
+    /* Keys are built up front so that only the table is measured */
+    std::vector<FiveTupleKey> keys(flows);
+    for (size_t i=0; i<flows; ++i) {
+        keys[i] = synthetic_key(i);
+    }
+
+    const struct {
+        const char* name;
+        double alpha;
+    } distributions[] = {{"uniform", 0}, {"zipf", alpha}};
+
+    for (auto& d : distributions) {
+        std::vector<uint32_t> trace = synthetic_trace(lookups, flows, d.alpha);
+
+        /* Reference ids of a sequential pass */
+        std::vector<uint32_t> expected(lookups);
+        FlowTable<FiveTupleKey> reference;
+        bool is_new;
+        for (size_t i=0; i<lookups; ++i) {
+            expected[i] = reference.find_or_insert(keys[trace[i]], is_new);
+        }
+
+        MESSAGE("Distribution: %s (%lu packets, %lu flows seen)\n", d.name,
+                lookups, reference.size());
+        MESSAGE("  %8s %10s %12s %12s %14s\n", "threads", "ms", "Mpkt/s",
+                "renumber ms", "deterministic");
+        std::vector<uint32_t> ids(lookups);
+        for (long t : counts) {
+            ConcurrentFlowTable<FiveTupleKey> table(flows, shards);
+            ThreadPool pool(t, pin);
+            auto start = std::chrono::steady_clock::now();
+            parallel_for(0, t, 1, [&](size_t k, size_t) {
+                size_t first = lookups * k / t;
+                size_t last = lookups * (k+1) / t;
+                bool inserted;
+                for (size_t i=first; i<last; ++i) {
+                    ids[i] = table.find_or_insert(keys[trace[i]], inserted, i);
+                }
+            }, pool);
+            double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            std::vector<uint32_t> remap = table.deterministic_ids();
+            parallel_for(0, lookups, 0, [&](size_t first, size_t last) {
+                for (size_t i=first; i<last; ++i) {
+                    ids[i] = remap[ids[i]];
+                }
+            }, pool);
+            double renumber_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            MESSAGE("  %8ld %10.1f %12.1f %12.1f %14s\n", t, ms,
+                    lookups / ms / 1e3, renumber_ms,
+                    ids == expected ? "yes" : "NO");
+        }
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    LOG_SET_STDOUT;
+    arg_parse(argc, argv, args);
+
+    try {
+        if (ARG_BOOL(args, "mode-flow-table", 0)) {
+            mode_flow_table();
+        } else if (ARG_BOOL(args, "mode-flow-lookup", 0)) {
+            mode_flow_lookup();
+        } else if (ARG_BOOL(args, "mode-decode", 0)) {
+            mode_decode();
+        } else if (ARG_BOOL(args, "mode-thread-pool", 0)) {
+            mode_thread_pool();
+        } else if (ARG_BOOL(args, "mode-concurrent-flow-table", 0)) {
+            mode_concurrent_flow_table();
+        } else {
+            throw errorf("No mode was specified");
+        }
+    } catch (std::exception & e) {
+        MESSAGE("Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -4,20 +4,94 @@
 #include <queue>
 #include <set>
 #include <map>
-#include <atomic>
+#include <memory>
 #include <iostream>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <chrono>
 
 #include "arguments.h"
 #include "log.h"
+#include "pcap-analyzer-api.h"
+#include "string-ops.h"
+#include "miss-ratio-curve.h"
+#include "trace-file.h"
+#include "trace-cache.h"
+#include "integer-parser.h"
+#include "page-allocator.h"
+#include "thread-pool.h"
 
 static arguments args[] = {
 /* Name               R  B  Def        Help */
-{"in",                1, 0, NULL,      "Output filename."},
+{"in",                0, 0, NULL,      "Input locality filename (text, or "
+                                       "a binary trace file). With "
+                                       "\"cache-sim\", also a pcap file with "
+                                       "a valid cache."},
+{"pcap",              0, 0, NULL,      "Input PCAP filenames, separated by "
+                                       "semicolon (instead of \"in\")."},
+{"flow-key",          0, 0, "5-tuple", "With \"pcap\": what identifies a "
+                                       "flow (5-tuple, src-ip, dst-ip, "
+                                       "src-dst, dst-24, proto-dport or "
+                                       "5-tuple-dual; the last two also "
+                                       "read IPv6 packets)."},
+{"cache",             0, 1, NULL,      "With \"pcap\": load the parsed-trace "
+                                       "cache (FILE.cache) of every file if "
+                                       "it is valid for the flow key, and "
+                                       "write it otherwise (see "
+                                       "tool-pcap-analyzer)."},
+{"cache-max-mb",      0, 0, "1024",    "Caches larger than VALUE MB are not "
+                                       "written."},
+{"read-ahead",        0, 1, NULL,      "Read the inputs with asynchronous "
+                                       "read-ahead (io_uring, or a pread "
+                                       "thread pool) into a ring of aligned "
+                                       "buffers, with O_DIRECT, instead of "
+                                       "mmap."},
+{"read-ahead-block",  0, 0, "8192",    "(Read-ahead) Buffer size in KB."},
+{"read-ahead-depth",  0, 0, "4",       "(Read-ahead) Number of buffers "
+                                       "(reads in flight)."},
+{"read-ahead-buffered",0,1, NULL,      "(Read-ahead) Read through the page "
+                                       "cache instead of O_DIRECT (consumed "
+                                       "pages are dropped)."},
+{"pages",             0, 0, "default", "Backing of flow tables and trace "
+                                       "columns: default (malloc), thp (2 "
+                                       "MB aligned, transparent huge pages) "
+                                       "or hugetlb (reserved huge pages, "
+                                       "falls back to thp)."},
+{"memory-stats",      0, 1, NULL,      "Print allocation statistics to "
+                                       "stderr at exit."},
 {"window",            0, 0, "10",      "Window size."},
+{"mrc",               0, 1, NULL,      "Instead of the CDF, print the LRU "
+                                       "miss-ratio curve in the format "
+                                       "X (cache size) Y (miss ratio), "
+                                       "computed in one pass from stack "
+                                       "distances."},
+{"sample-rate",       0, 0, "1",       "(MRC) SHARDS spatial sampling rate "
+                                       "in (0,1]; only flows whose hash "
+                                       "falls below the rate are tracked."},
+{"sample-max",        0, 0, "0",       "(MRC) If positive, track at most "
+                                       "VALUE flows by lowering the sampling "
+                                       "rate on demand (constant memory)."},
+{"cache-sim",         0, 1, NULL,      "Instead of the CDF, replay the "
+                                       "locality through every combination "
+                                       "of \"policies\" and \"cache-sizes\", "
+                                       "and print the hit ratio of each."},
+{"policies",          0, 0, "lru;lfu;arc;s3fifo;emc",
+                                       "(Cache sim) Replacement policies, "
+                                       "separated by semicolon."},
+{"cache-sizes",       0, 0, "1000;10000;100000",
+                                       "(Cache sim) Cache sizes (entries), "
+                                       "separated by semicolon."},
+{"emc-ways",          0, 0, "2",       "(Cache sim) Associativity of the "
+                                       "\"emc\" policy; cache sizes must be "
+                                       "multiples of it."},
+{"threads",           0, 0, "0",       "(Cache sim) Number of threads; each "
+                                       "configuration runs on a single "
+                                       "thread (0: number of cores)."},
+{"pin",               0, 0, "none",    "Pinning of the worker threads: none, "
+                                       "cpu (one CPU each) or numa (one NUMA "
+                                       "node each, round robin)."},
 {NULL,                0, 0, NULL,      "Analyzes locality files and calcs the "
                                        "CDF of temporal locality within the "
                                        "given window size. Prints to stdout "
@@ -37,34 +111,14 @@ static arguments args[] = {
 static std::vector<long>
 read_integers_from_file(const char *fname)
 {
-    std::vector<long> output;
-    std::ifstream is;
-    std::string line;
-    long linenum;
-
-    is.open(fname);
-    if (is.bad()) {
-        std::cerr << "Cannot open '" << fname << "' for reading" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    std::cout << "Calculating nubmer of lines in '" << fname << "'..."
-              << std::endl;
-    linenum = 0;
-    while (std::getline(is, line)) {
-        linenum++;
-    }
-
     std::cout << "Reading data from '" << fname << "'..." << std::endl;
-
-    is.clear();
-    is.seekg(0);
-    output.reserve(linenum);
-
-    while (std::getline(is, line)) {
-        output.push_back(atol(line.c_str()));
+    std::unique_ptr<read_ahead_options> read_ahead = get_read_ahead_options(args);
+    if (!read_ahead) {
+        return parse_integers_file(fname);
     }
-
+    std::vector<long> output;
+    IntegerReader reader(fname, *read_ahead);
+    reader.for_each([&](long value) { output.push_back(value); });
     return output;
 }
 
@@ -95,6 +149,165 @@ push_value_to_window(std::vector<long> &window, long value)
     return idx;
 }
 
+/**
+ * @brief Calls "func" on every integer in "fname", one per line, without
+ * keeping the file in memory
+ */
+template <typename F>
+static void
+for_each_integer_in_file(const char *fname, F func)
+{
+    std::unique_ptr<read_ahead_options> read_ahead = get_read_ahead_options(args);
+    std::unique_ptr<IntegerReader> reader(read_ahead ?
+            new IntegerReader(fname, *read_ahead) : new IntegerReader(fname));
+    reader->for_each(func);
+}
+
+/**
+ * @brief Reads the locality of the PCAP files in "pcap_files" (separated by
+ * semicolon)
+ */
+static std::vector<long>
+read_locality_from_pcap(const char *pcap_files)
+{
+    StringOperations<std::string> str_ops;
+    std::vector<std::string> file_names = str_ops.split(pcap_files,
+            ";", [](const std::string& s) {return s;});
+    std::vector<long> output;
+
+    std::unique_ptr<pa_reader, void(*)(pa_reader*)> pcap_reader(
+            pa_reader_open(ARG_STRING(args, "flow-key", "5-tuple")),
+            pa_reader_close);
+    pa_reader* reader = pcap_reader.get();
+    if (!reader) {
+        throw errorf("%s", pa_error());
+    }
+    std::unique_ptr<read_ahead_options> read_ahead = get_read_ahead_options(args);
+    if (read_ahead && pa_reader_set_read_ahead(reader, read_ahead->block_size,
+                                               read_ahead->queue_depth,
+                                               read_ahead->direct) < 0) {
+        throw errorf("%s", pa_error());
+    }
+    if (ARG_BOOL(args, "cache", 0)) {
+        pa_reader_enable_cache(reader,
+                (uint64_t)ARG_INTEGER(args, "cache-max-mb", 1024) << 20);
+    }
+    for (auto& f : file_names) {
+        std::cout << "Parsing PCAP file '" << f << "'..." << std::endl;
+        if (pa_reader_read(reader, f.c_str(), -1) < 0) {
+            throw errorf("%s", pa_error());
+        }
+    }
+    size_t chunks = pa_reader_chunks(reader, PA_COLUMN_FLOWS, 0);
+    output.reserve(pa_reader_size(reader, PA_COLUMN_FLOWS, 0));
+    for (size_t i=0; i<chunks; ++i) {
+        size_t length;
+        const uint32_t* flows = (const uint32_t*)pa_reader_chunk(
+                reader, PA_COLUMN_FLOWS, 0, i, &length);
+        output.insert(output.end(), flows, flows + length);
+    }
+    return output;
+}
+
+/**
+ * @brief Prints the hit ratio of every (policy, size) configuration. The
+ * references are shared read-only by all threads: a binary trace file or
+ * a pcap cache is used in place through mmap, other inputs are loaded once.
+ */
+static void
+analyze_cache_sim(const char *fname, const char *pcap_files)
+{
+    StringOperations<std::string> str_ops;
+    std::vector<std::string> policies = str_ops.split(
+            ARG_STRING(args, "policies", ""), ";",
+            [](const std::string& s) {return s;});
+    std::vector<long> sizes = StringOperations<long>().split(
+            ARG_STRING(args, "cache-sizes", ""), ";",
+            [](const std::string& s) {return atol(s.c_str());});
+    size_t ways = ARG_INTEGER(args, "emc-ways", 2);
+
+    std::unique_ptr<pa_trace, void(*)(pa_trace*)> trace(NULL, pa_trace_close);
+    std::vector<uint32_t> loaded;
+    const uint32_t *refs;
+    size_t count;
+
+    if (fname && (is_trace_file(fname) || TraceCacheFile::is_valid(fname))) {
+        trace.reset(pa_trace_open(fname));
+        if (!trace) {
+            throw errorf("%s", pa_error());
+        }
+        refs = pa_trace_flows(trace.get());
+        count = pa_trace_size(trace.get());
+    } else {
+        std::vector<long> values = fname ? read_integers_from_file(fname) :
+                                           read_locality_from_pcap(pcap_files);
+        loaded.assign(values.begin(), values.end());
+        refs = loaded.data();
+        count = loaded.size();
+    }
+
+    struct config {
+        std::string policy;
+        size_t size;
+        uint64_t hits;
+    };
+    std::vector<config> configs;
+    for (auto& p : policies) {
+        for (auto s : sizes) {
+            configs.push_back(config{p, (size_t)s, 0});
+        }
+    }
+
+    std::cout << "Simulating " << configs.size() << " configurations over "
+              << count << " references with "
+              << ThreadPool::shared().size() << " threads..." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(0, configs.size(), 1, [&](size_t i, size_t) {
+        if (pa_cache_hits(configs[i].policy.c_str(), configs[i].size, ways,
+                          refs, count, &configs[i].hits) < 0) {
+            throw errorf("%s", pa_error());
+        }
+    });
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Simulation took " << seconds << " seconds ("
+              << configs.size() * count / seconds / 1e6
+              << " M references/sec)" << std::endl;
+    std::cout << "Results: policy cache-size hits hit-ratio" << std::endl;
+    for (auto& c : configs) {
+        std::cout << c.policy << " " << c.size << " " << c.hits << " "
+                  << (count ? (double)c.hits / count : 0) << std::endl;
+    }
+}
+
+/**
+ * @brief Prints the LRU miss-ratio curve of the locality in "fname" (or in
+ * "pcap_files" if "fname" is NULL)
+ */
+static void
+analyze_mrc(const char *fname, const char *pcap_files)
+{
+    double rate = ARG_DOUBLE(args, "sample-rate", 1);
+    long max_tracked = ARG_INTEGER(args, "sample-max", 0);
+    MissRatioCurve mrc(rate, max_tracked);
+
+    if (fname) {
+        std::cout << "Reading data from '" << fname << "'..." << std::endl;
+        for_each_integer_in_file(fname, [&](long v) { mrc.access(v); });
+    } else {
+        for (auto v : read_locality_from_pcap(pcap_files)) {
+            mrc.access(v);
+        }
+    }
+
+    std::cout << "Sampling rate: " << mrc.rate()
+              << ", tracked flows: " << mrc.tracked() << std::endl;
+    std::cout << "Results: cache-size miss-ratio" << std::endl;
+    mrc.write(std::cout);
+}
+
 static void
 analyze(const std::vector<long> nums, int window_size)
 {
@@ -135,16 +348,43 @@ main(int argc, char** argv)
 {
     std::vector<long> nums;
     const char *fname;
+    const char *pcap_files;
     int window;
 
     LOG_SET_STDOUT;
     arg_parse(argc, argv, args);
 
     fname = ARG_STRING(args, "in", NULL);
+    pcap_files = ARG_STRING(args, "pcap", NULL);
     window = ARG_INTEGER(args, "window", 10);
-    nums = read_integers_from_file(fname);
-    analyze(nums, window);
 
+    if (!fname && !pcap_files) {
+        std::cerr << "Either \"in\" or \"pcap\" is required" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        set_page_mode(parse_page_mode(ARG_STRING(args, "pages", "default")));
+        ThreadPool::configure_shared(
+                std::max(0L, (long)ARG_INTEGER(args, "threads", 0)),
+                parse_pin_mode(ARG_STRING(args, "pin", "none")));
+        if (ARG_BOOL(args, "mrc", 0)) {
+            analyze_mrc(fname, pcap_files);
+        } else if (ARG_BOOL(args, "cache-sim", 0)) {
+            analyze_cache_sim(fname, pcap_files);
+        } else {
+            nums = fname ? read_integers_from_file(fname) :
+                           read_locality_from_pcap(pcap_files);
+            analyze(nums, window);
+        }
+    } catch (std::exception & e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (ARG_BOOL(args, "memory-stats", 0)) {
+        write_memory_stats(std::cerr);
+    }
     return 0;
 }
 
@@ -6,17 +6,27 @@
 #include <map>
 #include <atomic>
 #include <iostream>
+#include <memory>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
-#include <pthread.h>
+#include <unistd.h>
+#include <thread>
 
 #include "arguments.h"
 #include "log.h"
 #include "zipf.h"
-#include "pcap-utils.h"
+#include "pcap-analyzer-api.h"
 #include "string-ops.h"
+#include "hash.h"
+#include "hyperloglog.h"
+#include "trace-file.h"
+#include "trace-cache.h"
+#include "locality-window.h"
+#include "integer-parser.h"
+#include "page-allocator.h"
+#include "thread-pool.h"
 
 using namespace std;
 
@@ -25,6 +35,27 @@ static arguments args[] = {
 // Name                R  B  Def        Help
 // Mandatory arguments
 {"out",                1, 0, NULL,      "Output filename."},
+// Input
+{"read-ahead",         0, 1, NULL,      "Read classic pcap and text inputs "
+                                        "with asynchronous read-ahead "
+                                        "(io_uring, or a pread thread pool) "
+                                        "into a ring of aligned buffers, "
+                                        "with O_DIRECT, instead of mmap."},
+{"read-ahead-block",   0, 0, "8192",    "(Read-ahead) Buffer size in KB."},
+{"read-ahead-depth",   0, 0, "4",       "(Read-ahead) Number of buffers "
+                                        "(reads in flight)."},
+{"read-ahead-buffered",0, 1, NULL,      "(Read-ahead) Read through the page "
+                                        "cache instead of O_DIRECT (consumed "
+                                        "pages are dropped)."},
+// Memory
+{"pages",              0, 0, "default", "Backing of flow tables, trace "
+                                        "columns and window counts: default "
+                                        "(malloc), thp (2 MB aligned, "
+                                        "transparent huge pages) or hugetlb "
+                                        "(reserved huge pages, falls back to "
+                                        "thp)."},
+{"memory-stats",       0, 1, NULL,      "Print allocation statistics at "
+                                        "exit."},
 // Mode Locality:Zipf
 {"mode-locality-zipf", 0, 1, NULL,      "(Mode Locality:Zipf) Generate Zipf "
                                         "locality file. (No input file "
@@ -43,19 +74,131 @@ static arguments args[] = {
                                         " packe sizes."},
 {"pcap",               0, 0, NULL,      "(Mode PCAP) Input PCAP "
                                         "filenames, separated by semicolon."},
+{"flow-key",           0, 0, "5-tuple", "(Mode PCAP) What identifies a flow: "
+                                        "5-tuple, src-ip, dst-ip, src-dst "
+                                        "(address pair), dst-24 "
+                                        "(destination /24 prefix), "
+                                        "proto-dport (protocol and "
+                                        "destination port) or 5-tuple-dual "
+                                        "(IPv4 and IPv6 5-tuple). Only "
+                                        "5-tuple-dual and proto-dport read "
+                                        "IPv6 packets."},
+{"merge",              0, 1, NULL,      "(Mode PCAP) Interleave the packets "
+                                        "of all PCAP files by timestamp "
+                                        "(e.g. captures of several taps) "
+                                        "instead of reading them one after "
+                                        "the other."},
+{"flow-keys",          0, 0, NULL,      "(Mode PCAP) Flow keys separated by "
+                                        "semicolon (see \"flow-key\"; also "
+                                        "proto-dport). Extracts the locality "
+                                        "of all keys in a single pass; the "
+                                        "outputs of \"out\" and \"out-trace\" "
+                                        "get the suffix \".KEY\"."},
+{"filter",             0, 0, NULL,      "(Mode PCAP) Only keep packets that "
+                                        "match this BPF expression. "
+                                        "Conjunctions (and) of tcp, udp, "
+                                        "icmp, ip proto N, [src|dst] net "
+                                        "CIDR, [src|dst] host IP and "
+                                        "[src|dst] port N are evaluated "
+                                        "natively."},
+{"from",               0, 0, NULL,      "(Mode PCAP) Only read packets from "
+                                        "this timestamp (usec since the "
+                                        "epoch)."},
+{"to",                 0, 0, NULL,      "(Mode PCAP) Only read packets "
+                                        "before this timestamp (usec since "
+                                        "the epoch)."},
+{"index",              0, 1, NULL,      "(Mode PCAP) Write a sidecar index "
+                                        "(FILE.idx) of checkpoints for every "
+                                        "pcap read in full, so that later "
+                                        "runs with \"from\"/\"to\" seek "
+                                        "straight to the range."},
+{"cache",              0, 1, NULL,      "(Mode PCAP) Keep a parsed-trace "
+                                        "cache (FILE.cache) next to every "
+                                        "pcap read in full: later runs with "
+                                        "the same flow key and options load "
+                                        "it instead of parsing the file. "
+                                        "Caches of changed files are "
+                                        "ignored and rewritten. Not used "
+                                        "with \"merge\", several keys or "
+                                        "\"sample-every\"."},
+{"cache-max-mb",       0, 0, "1024",    "(Mode PCAP) Caches larger than "
+                                        "VALUE MB are not written."},
+{"sample-every",       0, 0, NULL,      "(Mode PCAP) Keep one packet in "
+                                        "VALUE (deterministic)."},
+{"sample-flows",       0, 0, NULL,      "(Mode PCAP) Keep the fraction VALUE "
+                                        "in (0,1] of the flows (by key "
+                                        "hash), with all their packets."},
+{"sample-seed",        0, 0, "0",       "(Mode PCAP) Selects which flows "
+                                        "\"sample-flows\" keeps."},
+{"sample-slice",       0, 0, NULL,      "(Mode PCAP) Keep the first VALUE "
+                                        "usec of every \"sample-period\" "
+                                        "usec (aligned to the epoch)."},
+{"sample-period",      0, 0, NULL,      "(Mode PCAP) Period of "
+                                        "\"sample-slice\" (usec)."},
+{"flow-dict",          0, 0, NULL,      "(Mode PCAP) Persistent flow "
+                                        "dictionary file. If it exists, flow "
+                                        "ids continue from it (so ids are "
+                                        "consistent across runs); it is "
+                                        "updated atomically with the new "
+                                        "flows at the end. With several "
+                                        "keys, gets the suffix \".KEY\"."},
 {"out-sizes",          0, 0, NULL,      "(Mode Pcap) if supplied, "
                                         "writes to file VALUE the packet sizes "
                                         "(in bytes)."},
 {"out-times",          0, 0, NULL,      "(Mode Pcap) if supplied, "
                                         "writes to file VALUE the packets "
                                         "timestamps (usec)."},
+{"out-trace",          0, 0, NULL,      "(Mode Pcap) if supplied, "
+                                        "writes to file VALUE a binary trace "
+                                        "with the locality and timestamps of "
+                                        "all packets (usable in place via "
+                                        "mmap)."},
+{"out-histograms",     0, 0, NULL,      "(Mode Pcap) if supplied, "
+                                        "writes to file VALUE the quantiles "
+                                        "and CDFs of the packet sizes, "
+                                        "inter-packet delays and per-flow "
+                                        "inter-arrival times."},
 // Mode Locality: Analyze
 {"mode-locality-analyze",0,1,NULL,      "(Mode Locality:Analyze) "
                                         "Use a sliding window to analyze the "
                                         "temporal locality within a locality "
                                         "file"},
+{"locality",           0,0,  NULL,      "(Mode Locality:Analyze) Input "
+                                        "locality filename (text, a binary "
+                                        "trace file, or a pcap file with a "
+                                        "valid cache, see \"cache\")."},
+{"times",              0,0,  NULL,      "(Mode Locality:Analyze) Input "
+                                        "timestamps filename (usec, one per "
+                                        "line, paired with the locality "
+                                        "file). Not needed with a binary "
+                                        "trace file that has timestamps."},
 {"window",             0,0,  "3000000", "(Mode Locality:Analyze) window size"},
 {"step",               0,0,  "800000",  "(Mode Locality:Analyze) step size"},
+{"window-usec",        0,0,  NULL,      "(Mode Locality:Analyze) If "
+                                        "supplied, the window holds the "
+                                        "packets of the last VALUE usec "
+                                        "instead of \"window\" packets. "
+                                        "Requires timestamps."},
+{"step-usec",          0,0,  NULL,      "(Mode Locality:Analyze) Step size in "
+                                        "usec, with \"window-usec\"."},
+{"distinct",           0,1,  NULL,      "(Mode Locality:Analyze) Add a second "
+                                        "column with the estimated number of "
+                                        "distinct flows within the last "
+                                        "ceil(window/step) steps "
+                                        "(HyperLogLog)."},
+{"threads",            0,0,  "1",       "(Mode Locality:Analyze) Number of "
+                                        "threads (0: number of cores). With "
+                                        "more than one thread the input is "
+                                        "split into segments that are "
+                                        "analyzed in parallel; text inputs "
+                                        "are loaded into memory first."},
+{"hll-precision",      0,0,  "14",      "(Mode Locality:Analyze) HyperLogLog "
+                                        "precision P; uses 2^P bytes per step, "
+                                        "standard error is 1.04/sqrt(2^P)."},
+{"pin",                0,0,  "none",    "(Mode Locality:Analyze) Pinning of "
+                                        "the worker threads: none, cpu (one "
+                                        "CPU each) or numa (one NUMA node "
+                                        "each, round robin)."},
 {NULL,                 0, 0, NULL,      "Analyzes PCAP files. Extracts "
                                         "5-tuples locality, packet sizes, and "
                                         "inter-packet delays. Zipf locality "
@@ -128,10 +271,11 @@ analyze_locality_percent(vector<long>& locality)
 }
 
 /**
- * @brief Writes a vector of integers to file
+ * @brief Writes a container of integers to file
  */
+template <typename C>
 void
-write_integers_to_file(const char* filename, const vector<long>& vec)
+write_integers_to_file(const char* filename, const C& vec)
 {
     std::ofstream file_out(filename, ios_base::out | ios_base::trunc);
     if (!file_out.is_open()) {
@@ -143,59 +287,191 @@ write_integers_to_file(const char* filename, const vector<long>& vec)
     file_out.close();
 }
 
+/**
+ * @brief Throws the last error of the library if "rc" is negative
+ */
+static void
+check(long rc)
+{
+    if (rc < 0) {
+        throw errorf("%s", pa_error());
+    }
+}
 
 /**
- * @brief Slide a window over the locality file, return a list of locality reuse
- * factor (0-1)
- * @param filename Locality filename
- * @param window Size of sliding window
- * @param step Size of analysis
- * @param os Stream to write results into
+ * @brief Writes column "column" (elements of type "T") of "reader" to
+ * file, one integer per line, straight from the reader's chunks
+ */
+template <typename T>
+void
+write_column_to_file(const char* filename, const pa_reader* reader,
+                     int column, size_t key = 0)
+{
+    std::ofstream file_out(filename, ios_base::out | ios_base::trunc);
+    if (!file_out.is_open()) {
+        throw errorf("Cannot write to file \"%s\"", filename);
+    }
+    size_t chunks = pa_reader_chunks(reader, column, key);
+    for (size_t i=0; i<chunks; ++i) {
+        size_t length;
+        const T* data = (const T*)pa_reader_chunk(reader, column, key, i,
+                                                  &length);
+        for (size_t j=0; j<length; ++j) {
+            file_out << data[j] << std::endl;
+        }
+    }
+    file_out.close();
+}
+
+typedef std::unique_ptr<pa_trace, void(*)(pa_trace*)> binary_locality;
+
+/**
+ * @brief Returns true if "filename" is a locality input used in place: a
+ * binary trace file, or a pcap file with a valid parsed-trace cache
+ */
+static bool
+is_binary_locality(const char* filename)
+{
+    return is_trace_file(filename) || TraceCacheFile::is_valid(filename);
+}
+
+/**
+ * @brief Maps the locality input "filename" (see "is_binary_locality")
+ */
+static binary_locality
+open_binary_locality(const char* filename)
+{
+    binary_locality trace(pa_trace_open(filename), pa_trace_close);
+    if (!trace) {
+        throw errorf("%s", pa_error());
+    }
+    if (!is_trace_file(filename)) {
+        MESSAGE("Reading the cache of pcap file \"%s\"\n", filename);
+    }
+    return trace;
+}
+
+/**
+ * @brief Slide a window over the locality file, writes per step the
+ * locality reuse factor (0-1). See "LocalityWindow".
+ * @param filename Locality filename (text, a binary trace file, or a
+ * cached pcap file)
+ * @param times_filename Timestamps filename (text, one per line) or NULL.
+ * Required in time mode unless the trace file has timestamps.
+ * @param window The sliding window
  */
 void
 parse_locality_file(const char* filename,
-                    int window,
-                    int step,
-                    std::ostream& os)
+                    const char* times_filename,
+                    LocalityWindow& window)
 {
+    binary_locality trace(NULL, pa_trace_close);
+    if (is_binary_locality(filename)) {
+        trace = open_binary_locality(filename);
+        if (!times_filename) {
+            const uint32_t* flows = pa_trace_flows(trace.get());
+            const int64_t* times = pa_trace_times(trace.get());
+            if (window.needs_times() && !times) {
+                throw errorf("Trace file \"%s\" has no timestamps", filename);
+            }
+            for (size_t i=0; i<pa_trace_size(trace.get()); ++i) {
+                window.push(flows[i], times ? times[i] : 0);
+            }
+            return;
+        }
+    } else if (window.needs_times() && !times_filename) {
+        throw errorf("Time windows require a timestamps file (\"times\")");
+    }
 
-    std::ifstream file_in (filename);
+    std::unique_ptr<read_ahead_options> read_ahead = get_read_ahead_options(args);
+    auto open_reader = [&](const char* name) {
+        return read_ahead ? new IntegerReader(name, *read_ahead)
+                          : new IntegerReader(name);
+    };
 
-    if (!file_in.is_open()) {
-        throw errorf("Cannot read file \"%s\"", filename);
+    std::unique_ptr<IntegerReader> file_in;
+    if (!trace) {
+        file_in.reset(open_reader(filename));
+    }
+    std::unique_ptr<IntegerReader> times_in;
+    if (times_filename) {
+        times_in.reset(open_reader(times_filename));
     }
 
-    vector<int> sliding_window(window);
-    multiset<int> values;
+    size_t i = 0;
 
-    int i = 0;
-    int j = 0;
-    int reuse = 0;
-    string line;
+    while (true) {
+        long current;
+        long time = 0;
 
-    while (getline(file_in, line)) {
-        int current = atoi(line.c_str());
+        if (trace) {
+            if (i == pa_trace_size(trace.get())) {
+                break;
+            }
+            current = pa_trace_flows(trace.get())[i++];
+        } else if (!file_in->next(current)) {
+            break;
+        }
 
-        if (values.find(current) != values.end()) {
-            reuse++;
+        if (times_in && !times_in->next(time)) {
+            throw errorf("Timestamps file \"%s\" has fewer records than "
+                         "the locality file", times_filename);
         }
 
-        /* Update the values and the sliding window */
-        values.erase(sliding_window[i]);
-        values.insert(current);
-        sliding_window[i] = current;
-        i++;
-        j++;
+        window.push(current, time);
+    }
+}
+
+/**
+ * @brief Same as "parse_locality_file", but splits the input into segments
+ * that are analyzed by "num_threads" threads
+ */
+void
+parse_locality_file_parallel(const char* filename,
+                             const char* times_filename,
+                             bool by_time,
+                             long window,
+                             long step,
+                             int hll_precision,
+                             int num_threads,
+                             std::ostream& os)
+{
+    vector<long> flows;
+    vector<long> times;
+
+    if (times_filename) {
+        times = parse_integers_file(times_filename, num_threads);
+    }
 
-        if (i == window) {
-            i = 0;
+    if (is_binary_locality(filename)) {
+        binary_locality trace = open_binary_locality(filename);
+        const uint32_t* trace_flows = pa_trace_flows(trace.get());
+        size_t size = pa_trace_size(trace.get());
+        if (!times_filename) {
+            if (by_time && !pa_trace_times(trace.get())) {
+                throw errorf("Trace file \"%s\" has no timestamps", filename);
+            }
+            analyze_locality_parallel(trace_flows, pa_trace_times(trace.get()),
+                                      size, by_time, window, step,
+                                      hll_precision, num_threads, os);
+            return;
         }
-        if (j == step) {
-            os << (float)reuse / window << std::endl;
-            reuse = 0;
-            j = 0;
+        flows.assign(trace_flows, trace_flows + size);
+    } else {
+        if (by_time && !times_filename) {
+            throw errorf("Time windows require a timestamps file (\"times\")");
         }
+        flows = parse_integers_file(filename, num_threads);
+    }
+
+    if (times_filename && times.size() < flows.size()) {
+        throw errorf("Timestamps file \"%s\" has fewer records than "
+                     "the locality file", times_filename);
     }
+    analyze_locality_parallel(flows.data(),
+                              times_filename ? times.data() : NULL,
+                              flows.size(), by_time, window, step,
+                              hll_precision, num_threads, os);
 }
 
 /**
@@ -226,43 +502,171 @@ mode_pcap()
     const char* locality_filename = ARG_STRING(args, "out", NULL);
     const char* sizes_filename = ARG_STRING(args, "out-sizes", NULL);
     const char* times_filename = ARG_STRING(args, "out-times", NULL);
+    const char* hist_filename = ARG_STRING(args, "out-histograms", NULL);
+    const char* trace_filename = ARG_STRING(args, "out-trace", NULL);
+    const char* filter = ARG_STRING(args, "filter", NULL);
+    const char* dict_filename = ARG_STRING(args, "flow-dict", NULL);
 
     string pcap_files = ARG_STRING(args, "pcap", NULL);
     if (pcap_files.size() == 0) {
         throw errorf("Mode trace requires pcap argument.");
     }
 
-    PcapReader pcap_reader;
+    StringOperations<string> str_ops;
+    std::vector<string> keys;
+    const char* flow_keys = ARG_STRING(args, "flow-keys", NULL);
+    if (flow_keys) {
+        keys = str_ops.split(flow_keys, ";", [](const string& s) {return s;});
+    }
+    if (keys.empty()) {
+        keys.push_back(ARG_STRING(args, "flow-key", "5-tuple"));
+    }
+
+    /* The first key drives the reader; the rest share its decoded packets */
+    MESSAGE("Flow key: %s\n", keys[0].c_str());
+    std::unique_ptr<pa_reader, void(*)(pa_reader*)> pcap_reader(
+            pa_reader_open(keys[0].c_str()), pa_reader_close);
+    pa_reader* reader = pcap_reader.get();
+    if (!reader) {
+        throw errorf("%s", pa_error());
+    }
+
+    if (hist_filename) {
+        check(pa_reader_enable_histograms(reader));
+    }
+    std::unique_ptr<read_ahead_options> read_ahead = get_read_ahead_options(args);
+    if (read_ahead) {
+        check(pa_reader_set_read_ahead(reader, read_ahead->block_size,
+                                       read_ahead->queue_depth,
+                                       read_ahead->direct));
+    }
+    if (ARG_BOOL(args, "index", 0)) {
+        check(pa_reader_enable_index(reader));
+    }
+    if (ARG_BOOL(args, "cache", 0)) {
+        check(pa_reader_enable_cache(reader,
+                (uint64_t)ARG_INTEGER(args, "cache-max-mb", 1024) << 20));
+    }
+    if (ARG_STRING(args, "sample-every", NULL)) {
+        check(pa_reader_sample_every(reader,
+                                     ARG_INTEGER(args, "sample-every", 1)));
+    }
+    if (ARG_STRING(args, "sample-flows", NULL)) {
+        check(pa_reader_sample_flows(reader,
+                                     ARG_DOUBLE(args, "sample-flows", 1),
+                                     ARG_INTEGER(args, "sample-seed", 0)));
+    }
+    if (ARG_STRING(args, "sample-slice", NULL)) {
+        long slice = ARG_INTEGER(args, "sample-slice", 0);
+        long period = ARG_STRING(args, "sample-period", NULL) ?
+                      ARG_INTEGER(args, "sample-period", 0) : slice;
+        check(pa_reader_sample_time(reader, slice, period));
+    }
+    if (ARG_STRING(args, "from", NULL) || ARG_STRING(args, "to", NULL)) {
+        int64_t from = ARG_STRING(args, "from", NULL) ?
+                       ARG_INTEGER(args, "from", 0) : INT64_MIN;
+        int64_t to = ARG_STRING(args, "to", NULL) ?
+                     ARG_INTEGER(args, "to", 0) : INT64_MAX;
+        check(pa_reader_set_time_range(reader, from, to));
+    }
+    if (filter) {
+        check(pa_reader_set_filter(reader, filter));
+        MESSAGE("Filter: %s (%s)\n", filter,
+                pa_reader_native_filter(reader) ? "native" : "BPF");
+    }
+    for (size_t k=1; k<keys.size(); ++k) {
+        MESSAGE("Flow key: %s\n", keys[k].c_str());
+        check(pa_reader_add_key(reader, keys[k].c_str()));
+    }
+
+    /* With several keys, every locality output is suffixed by its key */
+    size_t num_keys = pa_reader_keys(reader);
+    auto suffix = [&](size_t key) {
+        return num_keys > 1 ? string(".") + pa_reader_key_name(reader, key) :
+                              string();
+    };
+
+    if (dict_filename) {
+        for (size_t k=0; k<num_keys; ++k) {
+            string name = dict_filename + suffix(k);
+            if (access(name.c_str(), F_OK) == 0) {
+                long flows = pa_reader_load_flow_dict(reader, k, name.c_str());
+                check(flows);
+                MESSAGE("Loaded %ld flows from dictionary \"%s\"\n",
+                        flows, name.c_str());
+            }
+        }
+    }
 
     // Split by commas
-    StringOperations<string> str_ops;
     std::vector<string> file_names = str_ops.split(pcap_files,
             ";", [](const string& s) {return s;});
 
-    for (auto& f : file_names) {
-        size_t start_size = pcap_reader.get_locality().size();
+    if (ARG_BOOL(args, "merge", 0)) {
+        MESSAGE("Merging %lu PCAP files by timestamp... \n",
+                file_names.size());
+        std::vector<const char*> names;
+        for (auto& f : file_names) {
+            names.push_back(f.c_str());
+        }
+        check(pa_reader_read_merged(reader, names.data(), names.size(), -1));
+    } else {
+        for (auto& f : file_names) {
+            size_t start_size = pa_reader_size(reader, PA_COLUMN_FLOWS, 0);
 
-        MESSAGE("Parsing PCAP file \"%s\"... \n", f.c_str());
-        pcap_reader.read(f.c_str(), -1);
+            MESSAGE("Parsing PCAP file \"%s\"... \n", f.c_str());
+            check(pa_reader_read(reader, f.c_str(), -1));
 
-        size_t end_size = pcap_reader.get_locality().size();
-        MESSAGE("Extracted %lu values \n", end_size-start_size);
+            size_t end_size = pa_reader_size(reader, PA_COLUMN_FLOWS, 0);
+            MESSAGE("Extracted %lu values%s\n", end_size-start_size,
+                    pa_reader_cached(reader) ? " (from cache)" : " ");
+        }
     }
 
-    MESSAGE("Total values: %lu \n", pcap_reader.get_locality().size());
+    MESSAGE("Total values: %lu (%lu flows, %lu bytes in memory)\n",
+            pa_reader_size(reader, PA_COLUMN_FLOWS, 0),
+            pa_reader_flows(reader, 0),
+            pa_reader_memory(reader));
 
     // Write output
-    if (locality_filename) {
-        MESSAGE("Writing locality to file \"%s\"...\n", locality_filename);
-        write_integers_to_file(locality_filename, pcap_reader.get_locality());
+    for (size_t k=0; k<num_keys; ++k) {
+        if (k > 0) {
+            MESSAGE("Key %s: %lu flows\n", pa_reader_key_name(reader, k),
+                    pa_reader_flows(reader, k));
+        }
+        if (locality_filename) {
+            string name = locality_filename + suffix(k);
+            MESSAGE("Writing locality to file \"%s\"...\n", name.c_str());
+            write_column_to_file<uint32_t>(name.c_str(), reader,
+                                           PA_COLUMN_FLOWS, k);
+        }
+        if (k == 0 && sizes_filename) {
+            MESSAGE("Writing size to file \"%s\"...\n", sizes_filename);
+            write_column_to_file<uint16_t>(sizes_filename, reader,
+                                           PA_COLUMN_SIZES);
+        }
+        if (k == 0 && times_filename) {
+            MESSAGE("Writing timestamps to file \"%s\"...\n", times_filename);
+            write_column_to_file<int64_t>(times_filename, reader,
+                                          PA_COLUMN_TIMES);
+        }
+        if (trace_filename) {
+            string name = trace_filename + suffix(k);
+            MESSAGE("Writing binary trace to file \"%s\"...\n", name.c_str());
+            check(pa_reader_write_trace(reader, k, name.c_str()));
+        }
     }
-    if (sizes_filename) {
-        MESSAGE("Writing size to file \"%s\"...\n", sizes_filename);
-        write_integers_to_file(sizes_filename, pcap_reader.get_sizes());
+    if (hist_filename) {
+        MESSAGE("Writing histograms to file \"%s\"...\n", hist_filename);
+        check(pa_reader_write_histograms(reader, hist_filename));
     }
-    if (times_filename) {
-        MESSAGE("Writing timestamps to file \"%s\"...\n", times_filename);
-        write_integers_to_file(times_filename, pcap_reader.get_timestamps());
+    if (dict_filename) {
+        for (size_t k=0; k<num_keys; ++k) {
+            string name = dict_filename + suffix(k);
+            MESSAGE("Writing flow dictionary to file \"%s\"...\n",
+                    name.c_str());
+            check(pa_reader_save_flow_dict(reader, k, name.c_str()));
+        }
     }
 }
 
@@ -282,17 +686,51 @@ mode_locality_analyze()
         throw errorf("Cannot open locality file.");
     }
 
-    int window = ARG_INTEGER(args, "window", 3000000);
-    int step = ARG_INTEGER(args, "step", 800000);
+    const char* times_filename = ARG_STRING(args, "times", NULL);
+    bool by_time = ARG_STRING(args, "window-usec", NULL) != NULL;
+    long window = ARG_INTEGER(args, "window", 3000000);
+    long step = ARG_INTEGER(args, "step", 800000);
+    int precision = ARG_INTEGER(args, "hll-precision", 14);
+    int num_threads = ARG_INTEGER(args, "threads", 1);
 
-    MESSAGE("Analyzing locality file \"%s\" with window %d and step %d...\n",
-               locality_filename,
-               window,
-               step);
+    if (num_threads <= 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+
+    if (by_time) {
+        window = ARG_INTEGER(args, "window-usec", 0);
+        step = ARG_STRING(args, "step-usec", NULL) ?
+               ARG_INTEGER(args, "step-usec", 0) : window;
+    }
+
+    MESSAGE("Analyzing locality file \"%s\" with window %ld%s and "
+            "step %ld%s...\n",
+            locality_filename,
+            window, by_time ? " usec" : "",
+            step, by_time ? " usec" : "");
 
     os.open(out_filename);
 
-    parse_locality_file(locality_filename, window, step, os);
+    if (num_threads > 1) {
+        MESSAGE("Using %d threads\n", num_threads);
+        parse_locality_file_parallel(locality_filename, times_filename,
+                                     by_time, window, step,
+                                     ARG_BOOL(args, "distinct", 0) ?
+                                     precision : 0,
+                                     num_threads, os);
+        return;
+    }
+
+    std::unique_ptr<SlidingHyperLogLog> distinct;
+    if (ARG_BOOL(args, "distinct", 0)) {
+        int buckets = (window + step - 1) / step;
+        distinct.reset(new SlidingHyperLogLog(precision, buckets));
+        MESSAGE("Estimating distinct flows with %d HyperLogLog buckets "
+                "(%lu bytes)\n", buckets, distinct->memory());
+    }
+
+    LocalityWindow sliding(by_time, window, step, distinct.get(), os);
+    parse_locality_file(locality_filename, times_filename, sliding);
 }
 
 /**
@@ -308,6 +746,11 @@ main(int argc, char** argv)
     arg_parse(argc, argv, args);
 
     try {
+        set_page_mode(parse_page_mode(ARG_STRING(args, "pages", "default")));
+        ThreadPool::configure_shared(
+                std::max(0L, (long)ARG_INTEGER(args, "threads", 1)),
+                parse_pin_mode(ARG_STRING(args, "pin", "none")));
+
         // Act according to mode
         if (ARG_BOOL(args, "mode-locality-zipf", 0)) {
             mode_locality_zipf();
@@ -318,6 +761,12 @@ main(int argc, char** argv)
         } else {
             throw errorf("No mode was specified");
         }
+
+        if (ARG_BOOL(args, "memory-stats", 0)) {
+            std::ostringstream os;
+            write_memory_stats(os);
+            MESSAGE("%s", os.str().c_str());
+        }
     } catch (std::exception & e) {
         MESSAGE("Error: %s\n", e.what());
         return 1;
@@ -0,0 +1,456 @@
+#ifndef TRACE_CACHE_H
+#define TRACE_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+#include "errorf.h"
+#include "hash.h"
+#include "mapped-file.h"
+#include "flow-keys.h"
+#include "pcap-index.h"
+
+/*
+ * Parsed-trace cache of a pcap file ("FILE.cache"): what reading the whole
+ * file added to a trace, so that later runs load it instead of parsing the
+ * file again. Flows are numbered locally, from 0 in order of first
+ * appearance in the file. A fixed header is followed by the key (the raw
+ * key struct of the flow key type named in the header, with zero padding,
+ * so that a file gives the same cache on every run), the 5-tuple and, if
+ * TRACE_CACHE_HAS_ADDRESSES6 is set, the IPv6 addresses of every local
+ * flow; then, per packet, the local flow id, the length (bytes, not
+ * saturated) and the timestamp (usec). Columns are 8-byte aligned and used
+ * in place via mmap.
+ *
+ * The header identifies the input by a hash of its real path, its size,
+ * its modification time and a hash of its first TRACE_CACHE_PREFIX bytes;
+ * a cache that does not match the input is ignored. It also holds a hash
+ * of the reading options (filter, time range, sampling): a cache read with
+ * other options is ignored by "PcapReader", and replaced.
+ */
+const char TRACE_CACHE_MAGIC[8] = {'P','C','A','C','A','C','H','E'};
+const uint32_t TRACE_CACHE_VERSION = 1;
+const uint32_t TRACE_CACHE_HAS_ADDRESSES6 = 1;
+const size_t TRACE_CACHE_PREFIX = 1 << 20;
+
+struct trace_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    char key[16];
+    uint32_t key_size;
+    uint32_t reserved;
+    uint64_t path_hash;
+    uint64_t input_size;
+    int64_t input_mtime;
+    uint64_t content_hash;
+    uint64_t options;
+    uint64_t flows;
+    uint64_t packets;
+};
+
+/**
+ * @brief Identity of an input file, see "trace_cache_identity_of"
+ */
+struct trace_cache_identity {
+    uint64_t path_hash;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t content_hash;
+};
+
+/**
+ * @brief Offsets of the columns of a cache, given its header
+ */
+struct trace_cache_layout {
+    uint64_t keys;
+    uint64_t tuples;
+    uint64_t addresses6;
+    uint64_t flow_ids;
+    uint64_t lengths;
+    uint64_t times;
+    uint64_t end;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~7ULL;
+    }
+
+    trace_cache_layout(const trace_cache_header& hdr) {
+        keys = sizeof(trace_cache_header);
+        tuples = align(keys + hdr.flows * hdr.key_size);
+        addresses6 = align(tuples +
+                           hdr.flows * sizeof(std::array<uint32_t, 5>));
+        flow_ids = addresses6;
+        if (hdr.flags & TRACE_CACHE_HAS_ADDRESSES6) {
+            flow_ids += hdr.flows * sizeof(std::array<uint8_t, 32>);
+        }
+        lengths = align(flow_ids + hdr.packets * sizeof(uint32_t));
+        times = align(lengths + hdr.packets * sizeof(uint32_t));
+        end = times + hdr.packets * sizeof(int64_t);
+    }
+};
+
+/**
+ * @brief Returns the cache filename of "input_filename"
+ */
+static inline std::string
+trace_cache_filename(const char* input_filename)
+{
+    return std::string(input_filename) + ".cache";
+}
+
+/**
+ * @brief Hashes "length" bytes at "data", 8 at a time (the last word is
+ * padded with zeros)
+ */
+static inline uint64_t
+trace_cache_hash(const void* data, size_t length, uint64_t seed = 0)
+{
+    const char* bytes = (const char*)data;
+    uint64_t h = hash64(seed ^ length);
+    for (size_t i=0; i<length; i+=8) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, std::min<size_t>(8, length - i));
+        h = hash64(h ^ word);
+    }
+    return h;
+}
+
+/**
+ * @brief Reads the identity of "filename": the hash of its real path, its
+ * size, its modification time and the hash of its first
+ * TRACE_CACHE_PREFIX bytes. Returns false if it cannot be read.
+ */
+static inline bool
+trace_cache_identity_of(const char* filename, trace_cache_identity& id)
+{
+    if (!pcap_file_identity(filename, id.size, id.mtime)) {
+        return false;
+    }
+    char* path = realpath(filename, NULL);
+    if (!path) {
+        return false;
+    }
+    id.path_hash = trace_cache_hash(path, strlen(path));
+    free(path);
+
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        return false;
+    }
+    std::vector<char> prefix(std::min<uint64_t>(id.size, TRACE_CACHE_PREFIX));
+    bool ok = fread(prefix.data(), 1, prefix.size(), f) == prefix.size();
+    fclose(f);
+    id.content_hash = trace_cache_hash(prefix.data(), prefix.size());
+    return ok;
+}
+
+/**
+ * @brief Read-only memory mapped cache of an input file
+ */
+class TraceCacheFile {
+
+    MappedFile file;
+    const trace_cache_header* hdr;
+
+    template <typename T>
+    const T* column(uint64_t offset) const {
+        return (const T*)(file.data() + offset);
+    }
+
+public:
+
+    /**
+     * @brief Returns true if "input_filename" has a cache that matches
+     * its current identity "id"
+     */
+    static bool is_valid(const char* input_filename,
+                         const trace_cache_identity& id) {
+        std::string name = trace_cache_filename(input_filename);
+        trace_cache_header h;
+        FILE* f = fopen(name.c_str(), "rb");
+        if (!f) {
+            return false;
+        }
+        bool ok = fread(&h, sizeof(h), 1, f) == 1;
+        fclose(f);
+        return ok && !memcmp(h.magic, TRACE_CACHE_MAGIC, sizeof(h.magic)) &&
+               h.version == TRACE_CACHE_VERSION &&
+               h.path_hash == id.path_hash && h.input_size == id.size &&
+               h.input_mtime == id.mtime && h.content_hash == id.content_hash;
+    }
+
+    /**
+     * @brief Returns true if "input_filename" has a cache that matches it
+     */
+    static bool is_valid(const char* input_filename) {
+        trace_cache_identity id;
+        return access(trace_cache_filename(input_filename).c_str(),
+                      F_OK) == 0 &&
+               trace_cache_identity_of(input_filename, id) &&
+               is_valid(input_filename, id);
+    }
+
+    /**
+     * @brief Maps the cache of "input_filename" (see "is_valid")
+     */
+    TraceCacheFile(const char* input_filename)
+    : file(trace_cache_filename(input_filename).c_str()),
+      hdr((const trace_cache_header*)file.data())
+    {
+        if (file.size() < sizeof(*hdr) ||
+                trace_cache_layout(*hdr).end > file.size()) {
+            throw errorf("Cache of \"%s\" is truncated", input_filename);
+        }
+    }
+
+    /**
+     * @brief Returns the name of the flow key of the cache
+     */
+    std::string key_name() const {
+        return std::string(hdr->key, strnlen(hdr->key, sizeof(hdr->key)));
+    }
+
+    /**
+     * @brief Returns the hash of the reading options of the cache
+     */
+    uint64_t options() const {
+        return hdr->options;
+    }
+
+    /**
+     * @brief Returns the number of local flows
+     */
+    size_t flow_count() const {
+        return hdr->flows;
+    }
+
+    /**
+     * @brief Returns the number of packets
+     */
+    size_t size() const {
+        return hdr->packets;
+    }
+
+    /**
+     * @brief Returns the keys, indexed by local flow id, or NULL if the
+     * cache is not of flow key "Key"
+     */
+    template <typename Key>
+    const Key* keys() const {
+        if (key_name() != Key::name() || hdr->key_size != sizeof(Key)) {
+            return NULL;
+        }
+        return column<Key>(trace_cache_layout(*hdr).keys);
+    }
+
+    /**
+     * @brief Returns the 5-tuples, indexed by local flow id
+     */
+    const std::array<uint32_t, 5>* tuples() const {
+        return column<std::array<uint32_t, 5>>(
+                trace_cache_layout(*hdr).tuples);
+    }
+
+    /**
+     * @brief Returns the IPv6 addresses, indexed by local flow id (zero for
+     * IPv4 flows), or NULL if no flow is IPv6
+     */
+    const std::array<uint8_t, 32>* addresses6() const {
+        if (!(hdr->flags & TRACE_CACHE_HAS_ADDRESSES6)) {
+            return NULL;
+        }
+        return column<std::array<uint8_t, 32>>(
+                trace_cache_layout(*hdr).addresses6);
+    }
+
+    /**
+     * @brief Returns the local flow ids, one per packet
+     */
+    const uint32_t* flows() const {
+        return column<uint32_t>(trace_cache_layout(*hdr).flow_ids);
+    }
+
+    /**
+     * @brief Returns the packet lengths (bytes)
+     */
+    const uint32_t* lengths() const {
+        return column<uint32_t>(trace_cache_layout(*hdr).lengths);
+    }
+
+    /**
+     * @brief Returns the timestamps (usec)
+     */
+    const int64_t* times() const {
+        return column<int64_t>(trace_cache_layout(*hdr).times);
+    }
+};
+
+/**
+ * @brief Builds the cache of an input file while it is read in full: gets
+ * every packet that the reader appends to its trace, with its (global)
+ * flow id, and numbers the flows locally. Recording stops, and nothing is
+ * written, once the cache would exceed "max_bytes".
+ * @tparam Key The flow key type of the reader
+ */
+template <typename Key>
+class TraceCacheBuilder {
+
+    trace_cache_identity identity;
+    uint64_t max_bytes;
+    bool overflow;
+
+    /* Local flow id of every global flow id, or UINT32_MAX */
+    std::vector<uint32_t> local_of;
+
+    std::vector<Key> keys;
+    std::vector<std::array<uint32_t, 5>> tuples;
+    std::vector<std::array<uint8_t, 32>> addresses6;
+    bool has_addresses6;
+    std::vector<uint32_t> flows;
+    std::vector<uint32_t> lengths;
+    std::vector<int64_t> times;
+
+    trace_cache_header header(uint64_t options) const {
+        trace_cache_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, TRACE_CACHE_MAGIC, sizeof(hdr.magic));
+        hdr.version = TRACE_CACHE_VERSION;
+        hdr.flags = has_addresses6 ? TRACE_CACHE_HAS_ADDRESSES6 : 0;
+        strncpy(hdr.key, Key::name(), sizeof(hdr.key));
+        hdr.key_size = sizeof(Key);
+        hdr.path_hash = identity.path_hash;
+        hdr.input_size = identity.size;
+        hdr.input_mtime = identity.mtime;
+        hdr.content_hash = identity.content_hash;
+        hdr.options = options;
+        hdr.flows = keys.size();
+        hdr.packets = flows.size();
+        return hdr;
+    }
+
+    /**
+     * @brief Writes "bytes" bytes at "data" at "target", after padding
+     * from "offset"
+     */
+    static bool write_at(FILE* f, uint64_t& offset, uint64_t target,
+                         const void* data, size_t bytes) {
+        const char zeros[8] = {0};
+        uint64_t padding = target - offset;
+        offset = target + bytes;
+        return fwrite(zeros, 1, padding, f) == padding &&
+               fwrite(data, 1, bytes, f) == bytes;
+    }
+
+public:
+
+    /**
+     * @param identity Identity of the input, read before reading it
+     */
+    TraceCacheBuilder(const trace_cache_identity& identity,
+                      uint64_t max_bytes)
+    : identity(identity), max_bytes(max_bytes), overflow(false),
+      has_addresses6(false)
+    {}
+
+    /**
+     * @brief Registers the next packet of the trace
+     * @param flow Its flow id in the trace
+     * @param key,fields Its flow key and decoded fields
+     */
+    void add(uint32_t flow, const Key& key, const packet_fields& fields,
+             uint32_t length, int64_t timestamp) {
+        if (overflow) {
+            return;
+        }
+        if (flow >= local_of.size()) {
+            local_of.resize(flow + 1, UINT32_MAX);
+        }
+        if (local_of[flow] == UINT32_MAX) {
+            local_of[flow] = keys.size();
+            keys.push_back(key);
+            tuples.push_back(fields.tuple());
+            std::array<uint8_t, 32> addresses = {};
+            if (fields.version == 6) {
+                memcpy(addresses.data(), fields.ip6_src, 16);
+                memcpy(addresses.data() + 16, fields.ip6_dst, 16);
+                has_addresses6 = true;
+            }
+            addresses6.push_back(addresses);
+        }
+        flows.push_back(local_of[flow]);
+        lengths.push_back(length);
+        times.push_back(timestamp);
+
+        if (bytes() > max_bytes) {
+            overflow = true;
+            std::vector<uint32_t>().swap(local_of);
+            std::vector<Key>().swap(keys);
+            std::vector<std::array<uint32_t, 5>>().swap(tuples);
+            std::vector<std::array<uint8_t, 32>>().swap(addresses6);
+            std::vector<uint32_t>().swap(flows);
+            std::vector<uint32_t>().swap(lengths);
+            std::vector<int64_t>().swap(times);
+        }
+    }
+
+    /**
+     * @brief Returns the size of the cache file, in bytes
+     */
+    uint64_t bytes() const {
+        trace_cache_header hdr;
+        hdr.flags = has_addresses6 ? TRACE_CACHE_HAS_ADDRESSES6 : 0;
+        hdr.key_size = sizeof(Key);
+        hdr.flows = keys.size();
+        hdr.packets = flows.size();
+        return trace_cache_layout(hdr).end;
+    }
+
+    /**
+     * @brief Writes the cache of "input_filename" next to it, atomically.
+     * Returns false, and removes any previous cache, if the cache exceeds
+     * the size limit.
+     * @param options Hash of the reading options
+     */
+    bool write(const char* input_filename, uint64_t options) {
+        std::string name = trace_cache_filename(input_filename);
+        if (overflow) {
+            unlink(name.c_str());
+            return false;
+        }
+
+        trace_cache_header hdr = header(options);
+        trace_cache_layout layout(hdr);
+        write_file_atomic(name, "cache", [&](FILE* f) {
+            uint64_t offset = 0;
+            bool ok = write_at(f, offset, 0, &hdr, sizeof(hdr));
+            ok = ok && write_at(f, offset, layout.keys, keys.data(),
+                                keys.size() * sizeof(Key));
+            ok = ok && write_at(f, offset, layout.tuples, tuples.data(),
+                                tuples.size() * sizeof(tuples[0]));
+            if (has_addresses6) {
+                ok = ok && write_at(f, offset, layout.addresses6,
+                                    addresses6.data(),
+                                    addresses6.size() *
+                                    sizeof(addresses6[0]));
+            }
+            ok = ok && write_at(f, offset, layout.flow_ids, flows.data(),
+                                flows.size() * sizeof(uint32_t));
+            ok = ok && write_at(f, offset, layout.lengths, lengths.data(),
+                                lengths.size() * sizeof(uint32_t));
+            return ok && write_at(f, offset, layout.times, times.data(),
+                                  times.size() * sizeof(int64_t));
+        });
+        return true;
+    }
+};
+
+#endif
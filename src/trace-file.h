@@ -0,0 +1,171 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+#include <fstream>
+
+#include "errorf.h"
+#include "mapped-file.h"
+
+/*
+ * Binary trace container: a fixed header followed by a column of 32 bit
+ * flow ids and, if TRACE_HAS_TIMES is set, a column of 64 bit timestamps
+ * (usec). Columns are 8-byte aligned so the file can be used in place via
+ * mmap.
+ */
+const char TRACE_MAGIC[8] = {'P','C','A','T','R','A','C','E'};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_HAS_TIMES = 1;
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t count;
+    uint64_t reserved;
+};
+
+/**
+ * @brief Returns the offset of the timestamps column for "count" records
+ */
+static inline uint64_t
+trace_times_offset(uint64_t count)
+{
+    uint64_t offset = sizeof(trace_file_header) + count * sizeof(uint32_t);
+    return (offset + 7) & ~7ULL;
+}
+
+/**
+ * @brief Returns true if "filename" starts with the trace container magic
+ */
+static inline bool
+is_trace_file(const char* filename)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    std::ifstream is(filename, std::ios_base::binary);
+    if (!is.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * @brief Writes a trace container to "filename"
+ * @param flows Flow id per packet
+ * @param times Timestamp per packet (usec), or empty
+ */
+template <typename F, typename T>
+void
+write_trace_file(const char* filename, const F& flows, const T& times)
+{
+    if (times.size() && times.size() != flows.size()) {
+        throw errorf("Trace columns differ in size (%lu, %lu)",
+                     flows.size(), times.size());
+    }
+
+    std::ofstream os(filename, std::ios_base::binary | std::ios_base::trunc);
+    if (!os.is_open()) {
+        throw errorf("Cannot write to file \"%s\"", filename);
+    }
+
+    trace_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    hdr.version = TRACE_VERSION;
+    hdr.flags = times.size() ? TRACE_HAS_TIMES : 0;
+    hdr.count = flows.size();
+    os.write((const char*)&hdr, sizeof(hdr));
+
+    /* Columns are written through a small buffer to convert types */
+    std::vector<uint32_t> flow_buf;
+    flow_buf.reserve(4096);
+    for (auto f : flows) {
+        flow_buf.push_back(f);
+        if (flow_buf.size() == flow_buf.capacity()) {
+            os.write((const char*)flow_buf.data(), flow_buf.size() * 4);
+            flow_buf.clear();
+        }
+    }
+    os.write((const char*)flow_buf.data(), flow_buf.size() * 4);
+
+    if (hdr.flags & TRACE_HAS_TIMES) {
+        uint64_t padding = trace_times_offset(hdr.count) - sizeof(hdr) -
+                           hdr.count * sizeof(uint32_t);
+        const char zeros[8] = {0};
+        os.write(zeros, padding);
+        std::vector<int64_t> time_buf;
+        time_buf.reserve(4096);
+        for (auto t : times) {
+            time_buf.push_back(t);
+            if (time_buf.size() == time_buf.capacity()) {
+                os.write((const char*)time_buf.data(), time_buf.size() * 8);
+                time_buf.clear();
+            }
+        }
+        os.write((const char*)time_buf.data(), time_buf.size() * 8);
+    }
+
+    if (!os.good()) {
+        throw errorf("Error while writing to file \"%s\"", filename);
+    }
+}
+
+/**
+ * @brief Read-only memory mapped view of a trace container
+ */
+class TraceFile {
+
+    MappedFile file;
+    const trace_file_header* hdr;
+
+public:
+
+    TraceFile(const char* filename)
+    : file(filename), hdr((const trace_file_header*)file.data())
+    {
+        bool valid = file.size() >= sizeof(trace_file_header);
+        if (valid) {
+            uint64_t expected = sizeof(trace_file_header) +
+                                hdr->count * sizeof(uint32_t);
+            if (hdr->flags & TRACE_HAS_TIMES) {
+                expected = trace_times_offset(hdr->count) +
+                           hdr->count * sizeof(int64_t);
+            }
+            valid = !memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) &&
+                    hdr->version == TRACE_VERSION &&
+                    expected <= file.size();
+        }
+        if (!valid) {
+            throw errorf("File \"%s\" is not a valid trace file", filename);
+        }
+    }
+
+    /**
+     * @brief Returns the number of records
+     */
+    size_t size() const {
+        return hdr->count;
+    }
+
+    /**
+     * @brief Returns the flow ids column
+     */
+    const uint32_t* flows() const {
+        return (const uint32_t*)(hdr + 1);
+    }
+
+    /**
+     * @brief Returns the timestamps column (usec), or NULL if missing
+     */
+    const int64_t* times() const {
+        if (!(hdr->flags & TRACE_HAS_TIMES)) {
+            return NULL;
+        }
+        return (const int64_t*)(file.data() + trace_times_offset(hdr->count));
+    }
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef TRACE_STORE_H
+#define TRACE_STORE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <memory>
+#include <iterator>
+
+#include "page-allocator.h"
+
+/**
+ * @brief Append-only column stored in fixed-size chunks. Growing never
+ * copies existing elements, so there is no reallocation peak as with
+ * std::vector doubling. Chunks are carved from an arena, so with huge
+ * pages several chunks share a 2 MB page.
+ * @tparam T Element type
+ * @tparam ChunkBits log2 of the number of elements per chunk
+ */
+template <typename T, int ChunkBits = 16>
+class ChunkedColumn {
+
+    static const size_t chunk_size = 1ULL << ChunkBits;
+    static const size_t chunk_mask = chunk_size - 1;
+
+    Arena arena;
+    std::vector<T*> chunks;
+    size_t count;
+
+public:
+
+    class const_iterator {
+        const ChunkedColumn* column;
+        size_t idx;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator(const ChunkedColumn* column, size_t idx)
+        : column(column), idx(idx)
+        {}
+        const T& operator*() const {
+            return (*column)[idx];
+        }
+        const_iterator& operator++() {
+            ++idx;
+            return *this;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return idx != other.idx;
+        }
+        bool operator==(const const_iterator& other) const {
+            return idx == other.idx;
+        }
+    };
+
+    ChunkedColumn()
+    : arena(chunk_size * sizeof(T)), count(0)
+    {}
+
+    void push_back(const T& value) {
+        if ((count & chunk_mask) == 0 && (count >> ChunkBits) == chunks.size()) {
+            chunks.push_back((T*)arena.allocate(chunk_size * sizeof(T),
+                                                alignof(T)));
+        }
+        chunks[count >> ChunkBits][count & chunk_mask] = value;
+        count++;
+    }
+
+    const T& operator[](size_t idx) const {
+        return chunks[idx >> ChunkBits][idx & chunk_mask];
+    }
+
+    const T& back() const {
+        return (*this)[count - 1];
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, count);
+    }
+
+    /**
+     * @brief Returns the number of chunks
+     */
+    size_t chunk_count() const {
+        return (count + chunk_mask) >> ChunkBits;
+    }
+
+    /**
+     * @brief Returns chunk "idx" and sets "length" to its number of
+     * elements. Chunks never move; only the last one grows.
+     */
+    const T* chunk(size_t idx, size_t& length) const {
+        length = std::min<size_t>(size_t(chunk_size),
+                                  count - (idx << ChunkBits));
+        return chunks[idx];
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        return arena.memory();
+    }
+};
+
+/**
+ * @brief Compact struct-of-arrays trace: per packet a 32 bit flow id, a 16
+ * bit size (saturated at 65535 bytes) and a 64 bit timestamp (usec); the
+ * 5-tuple of every flow is stored once, indexed by flow id. The IPv6
+ * source and destination addresses of flows are stored apart (the 5-tuple
+ * has zero addresses), in a column that only exists once an IPv6 flow was
+ * added.
+ */
+class TraceStore {
+
+    ChunkedColumn<uint32_t> flows;
+    ChunkedColumn<uint16_t> sizes;
+    ChunkedColumn<int64_t> times;
+    ChunkedColumn<std::array<uint32_t, 5>, 12> tuples;
+    ChunkedColumn<std::array<uint8_t, 32>, 12> addresses6;
+
+public:
+
+    /**
+     * @brief Appends a packet of flow "flow"
+     */
+    void push(uint32_t flow, uint32_t size, int64_t timestamp) {
+        flows.push_back(flow);
+        sizes.push_back(size > UINT16_MAX ? UINT16_MAX : size);
+        times.push_back(timestamp);
+    }
+
+    /**
+     * @brief Registers the 5-tuple of the next new flow, returns its id
+     * @param addresses The IPv6 source and destination addresses (network
+     * byte order) of an IPv6 flow, or NULL
+     */
+    uint32_t add_flow(const std::array<uint32_t, 5>& tuple,
+                      const std::array<uint8_t, 32>* addresses = NULL) {
+        if (addresses || !addresses6.empty()) {
+            while (addresses6.size() < tuples.size()) {
+                addresses6.push_back(std::array<uint8_t, 32>());
+            }
+            addresses6.push_back(addresses ? *addresses :
+                                             std::array<uint8_t, 32>());
+        }
+        tuples.push_back(tuple);
+        return tuples.size() - 1;
+    }
+
+    const ChunkedColumn<uint32_t>& get_flows() const {
+        return flows;
+    }
+
+    const ChunkedColumn<uint16_t>& get_sizes() const {
+        return sizes;
+    }
+
+    const ChunkedColumn<int64_t>& get_times() const {
+        return times;
+    }
+
+    const ChunkedColumn<std::array<uint32_t, 5>, 12>& get_tuples() const {
+        return tuples;
+    }
+
+    /**
+     * @brief Returns the IPv6 addresses, indexed by flow id (zero for IPv4
+     * flows); empty if no flow is IPv6
+     */
+    const ChunkedColumn<std::array<uint8_t, 32>, 12>& get_addresses6() const {
+        return addresses6;
+    }
+
+    size_t size() const {
+        return flows.size();
+    }
+
+    /**
+     * @brief Returns the number of bytes allocated by this
+     */
+    size_t memory() const {
+        return flows.memory() + sizes.memory() + times.memory() +
+               tuples.memory() + addresses6.memory();
+    }
+};
+
+#endif